@@ -0,0 +1,89 @@
+/*
+ * Implementation of the arena interface. Chunks start small so that empty
+ * shards and short-lived lists stay cheap, and double up to a cap.
+ */
+
+/*
+ * Copyright (C) 2019 University of California, Berkeley
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ARENA_ALIGN 8
+#define ARENA_MIN_CHUNK (4 << 10)
+#define ARENA_MAX_CHUNK (1 << 20)
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    /* Keeps data aligned to ARENA_ALIGN on 32-bit hosts too. */
+    size_t pad;
+    char data[];
+};
+
+void arena_init(struct arena *arena) {
+    arena->chunks = NULL;
+    arena->next = NULL;
+    arena->end = NULL;
+    arena->bytes = 0;
+}
+
+void *arena_alloc(struct arena *arena, size_t size) {
+    void *p;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    if ((size_t) (arena->end - arena->next) < size) {
+        /*
+         * Start a new chunk as big as all the others put together, so the
+         * arena doubles until chunks reach ARENA_MAX_CHUNK; after that it
+         * grows by ARENA_MAX_CHUNK at a time. Whatever is left of the old
+         * chunk is wasted.
+         */
+        size_t chunk_size = arena->bytes < ARENA_MIN_CHUNK ? ARENA_MIN_CHUNK
+                                                           : arena->bytes;
+        struct arena_chunk *chunk;
+
+        if (chunk_size > ARENA_MAX_CHUNK) {
+            chunk_size = ARENA_MAX_CHUNK;
+        }
+        if (chunk_size < size) {
+            chunk_size = size;
+        }
+        if ((chunk = malloc(sizeof(struct arena_chunk) + chunk_size)) == NULL) {
+            perror("malloc");
+            return NULL;
+        }
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->next = chunk->data;
+        arena->end = chunk->data + chunk_size;
+        arena->bytes += chunk_size;
+    }
+    p = arena->next;
+    arena->next += size;
+    return p;
+}
+
+void arena_free(struct arena *arena) {
+    struct arena_chunk *chunk = arena->chunks;
+    while (chunk != NULL) {
+        struct arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena_init(arena);
+}
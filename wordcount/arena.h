@@ -0,0 +1,49 @@
+/*
+ * The arena interface provides a bump-pointer allocator. Allocations are
+ * carved in order out of large chunks and cannot be freed individually;
+ * everything in an arena is released at once by arena_free.
+ */
+
+/*
+ * Copyright (C) 2019 University of California, Berkeley
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+struct arena_chunk;
+
+struct arena {
+    struct arena_chunk *chunks; /* Most recently allocated chunk first. */
+    char *next;                 /* Free space in the current chunk. */
+    char *end;
+    size_t bytes;               /* Total size of all chunks. */
+};
+
+/* Initialize an empty arena. */
+void arena_init(struct arena *arena);
+
+/*
+ * Returns size bytes aligned for any word_count record, or NULL if out of
+ * memory.
+ */
+void *arena_alloc(struct arena *arena, size_t size);
+
+/* Release every allocation in the arena, leaving it empty. */
+void arena_free(struct arena *arena);
+
+#endif /* ARENA_H */
@@ -1,5 +1,6 @@
 /*
- * Word count application with one process per input file.
+ * Word count application with one process per input file, running up to a
+ * fixed number of them at once.
  *
  * You may modify this file in any way you like, and are expected to modify it.
  * Your solution must read each input file from a separate thread. We encourage
@@ -23,6 +24,9 @@
  */
 
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -32,102 +36,586 @@
 #include <sys/wait.h>
 
 #include "word_count.h"
+#include "word_emit.h"
 #include "word_helpers.h"
+#include "word_stats.h"
+
+/* Bytes read from a child's pipe per read(). */
+#define PIPE_READ_SIZE (64 << 10)
+
+/* A running child and the counts it has sent that are not yet merged. */
+struct child {
+    pid_t pid;
+    int fd;
+    char *buf;
+    size_t len;
+    size_t cap;
+};
+
+/* Send text records instead, as fprint_words prints them (-t). */
+static bool text_records = false;
+
+/* With -a, the parent's sketch; children send sketches instead of counts. */
+static struct word_sketch *sketch = NULL;
+
+/*
+ * Merge the complete "%8d\t%s\n" records at the start of buf[0..len) and
+ * return how many bytes they took up. A trailing partial record is left for
+ * the next call, once the rest of it has arrived.
+ */
+static size_t merge_counts(word_count_list_t *wclist, const char *buf, size_t len) {
+    const char *p = buf;
+    const char *end = buf + len;
+    const char *nl;
+    while ((nl = memchr(p, '\n', end - p)) != NULL) {
+        char *tab;
+        long count = strtol(p, &tab, 10);
+        if (tab == p || *tab != '\t' || tab + 1 == nl) {
+            fprintf(stderr, "read ill-formed count\n");
+        } else {
+            char *word = strndup(tab + 1, nl - tab - 1);
+            if (word == NULL || add_word_with_count(wclist, word, count) == NULL) {
+                perror("could not merge count");
+                free(word);
+            }
+        }
+        p = nl + 1;
+    }
+    return p - buf;
+}
+
+/*
+ * Fork a child that counts the words in filename and writes them to a pipe.
+ * Returns the parent's end of the pipe in c.
+ */
+static void start_child(struct child *c, char *filename) {
+    // pipefd[0] is the read end, pipefd[1] is the write end.
+    // the child will write word counts to the pipe, and the parent will read them back
+    int pipefd[2];
+    if (pipe(pipefd) == -1) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+
+    // fork a new child process
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+
+    if (pid == 0) {
+        // child process: counts words in one file
+        // close the read end of the pipe (child only writes)
+        close(pipefd[0]);
+
+        // open the file assigned to this child
+        FILE *fp = fopen(filename, "r");
+        if (fp == NULL) {
+            perror("could not open file");
+            exit(EXIT_FAILURE);
+        }
+
+        FILE *pipe_stream = fdopen(pipefd[1], "w");
+        if (sketch != NULL) {
+            // sketch this file and send the sketch
+            struct word_sketch child_sketch;
+            if (!sketch_init(&child_sketch, sketch->capacity)) {
+                perror("could not allocate sketch");
+                exit(EXIT_FAILURE);
+            }
+            count_words_sketch(&child_sketch, fp);
+            fclose(fp);
+            sketch_fwrite(&child_sketch, pipe_stream);
+            fclose(pipe_stream);
+            exit(EXIT_SUCCESS);
+        }
+
+        // count words in this file
+        word_count_list_t child_counts;
+        init_words(&child_counts);
+        count_words(&child_counts, fp);
+        fclose(fp);
+
+        // write the word counts to the pipe
+        if (text_records)
+            fprint_words(&child_counts, pipe_stream);
+        else
+            fwrite_records(&child_counts, pipe_stream);
+        fclose(pipe_stream); // also closes pipefd[1]
+
+        // exit child process
+        exit(EXIT_SUCCESS);
+    }
+
+    // parent process: close the write end of the pipe, so that the read end
+    // sees EOF once the child is done
+    close(pipefd[1]);
+    c->pid = pid;
+    c->fd = pipefd[0];
+    c->buf = NULL;
+    c->len = 0;
+    c->cap = 0;
+}
 
 /*
- * Read stream of counts and accumulate globally.
+ * Read what a child has sent so far and merge every complete record. A
+ * sketch is only merged once all of it has arrived. Returns false once the
+ * child has closed its pipe.
  */
-void merge_counts(word_count_list_t *wclist, FILE *count_stream) {
-    char *word;
-    int count;
-    int rv;
-    while ((rv = fscanf(count_stream, "%8d\t%ms\n", &count, &word)) == 2) {
-        add_word_with_count(wclist, word, count);
-    }
-    if ((rv == EOF) && (feof(count_stream) == 0)) {
+static bool drain_child(word_count_list_t *wclist, struct child *c) {
+    if (c->cap - c->len < PIPE_READ_SIZE) {
+        // grow geometrically, as a sketch accumulates whole
+        c->cap = c->len + PIPE_READ_SIZE > 2 * c->cap ? c->len + PIPE_READ_SIZE : 2 * c->cap;
+        if ((c->buf = realloc(c->buf, c->cap)) == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    ssize_t n = read(c->fd, c->buf + c->len, PIPE_READ_SIZE);
+    if (n < 0) {
+        if (errno == EINTR)
+            return true;
         perror("could not read counts");
-    } else if (rv != EOF) {
-        fprintf(stderr, "read ill-formed count (matched %d)\n", rv);
+        n = 0;
+    }
+    if (n == 0) {
+        if (sketch != NULL && c->len != 0 && !sketch_merge_buffer(sketch, c->buf, c->len))
+            fprintf(stderr, "read ill-formed sketch\n");
+        else if (sketch == NULL && c->len != 0)
+            fprintf(stderr, "read ill-formed count (truncated)\n");
+        return false;
+    }
+    c->len += n;
+    if (sketch != NULL)
+        return true;
+    size_t used = text_records ? merge_counts(wclist, c->buf, c->len)
+                               : merge_records(wclist, c->buf, c->len);
+    memmove(c->buf, c->buf + used, c->len - used);
+    c->len -= used;
+    return true;
+}
+
+/*
+ * Wait for any of children[0..running) to send counts and merge them. Children
+ * that have finished are reaped, if they have a pid, and dropped from the
+ * array. Returns how many are still running.
+ */
+static int poll_children(word_count_list_t *wclist, struct child *children,
+                         struct pollfd *fds, int running) {
+    for (int i = 0; i < running; i++) {
+        fds[i].fd = children[i].fd;
+        fds[i].events = POLLIN;
+    }
+    if (poll(fds, running, -1) == -1) {
+        if (errno == EINTR)
+            return running;
+        perror("poll");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = running - 1; i >= 0; i--) {
+        if (fds[i].revents == 0 || drain_child(wclist, &children[i]))
+            continue;
+        // child is done: reap it, don't care about exit status
+        close(children[i].fd);
+        free(children[i].buf);
+        if (children[i].pid > 0)
+            waitpid(children[i].pid, NULL, 0);
+        children[i] = children[--running];
+    }
+    return running;
+}
+
+/*
+ * Map/reduce mode (-r). Each of nmappers mapper processes counts every
+ * nmappers-th file and sends each count to one of nreducers reducer
+ * processes, chosen by a hash of the word, so that each reducer owns a
+ * disjoint share of the vocabulary. There is a pipe from every mapper to
+ * every reducer. A reducer merges what its mappers send, sorts its share
+ * and sends it to the parent as text, whose only work is to merge the
+ * sorted shares as it prints them.
+ */
+
+/* A mapper's streams to the reducers, for partition_word. */
+struct partition {
+    FILE **outs;
+    int nouts;
+};
+
+// foreach_word callback: send wc to the reducer that owns its word
+static void partition_word(word_count_t *wc, void *aux) {
+    struct partition *part = aux;
+    FILE *out = part->outs[word_hash(wc->word) % part->nouts];
+    if (text_records) {
+        fprintf(out, "%8d\t%s\n", wc->count, wc->word);
+    } else {
+        fwrite_record(out, wc->count, wc->word, strlen(wc->word));
+    }
+}
+
+/*
+ * Close every end of the npipes pipes in pipes except those for which keep
+ * returns true, so that a reducer sees EOF once all of its mappers are done.
+ */
+static void close_pipes(int (*pipes)[2], int npipes,
+                        bool keep(int pipe, int end, int id, int nreducers),
+                        int id, int nreducers) {
+    for (int i = 0; i < npipes; i++)
+        for (int end = 0; end < 2; end++)
+            if (!keep(i, end, id, nreducers))
+                close(pipes[i][end]);
+}
+
+// mapper id writes to pipes id * nreducers .. (id + 1) * nreducers - 1
+static bool mapper_end(int pipe, int end, int id, int nreducers) {
+    return end == 1 && pipe / nreducers == id;
+}
+
+// reducer id reads from pipes id, id + nreducers, id + 2 * nreducers, ...
+static bool reducer_end(int pipe, int end, int id, int nreducers) {
+    return end == 0 && pipe % nreducers == id;
+}
+
+/* Body of mapper id: count its files and partition the counts. */
+static void run_mapper(char **files, int nfiles, int id, int nmappers,
+                       int nreducers, int (*pipes)[2]) {
+    word_count_list_t counts;
+    struct partition part = { calloc(nreducers, sizeof(FILE *)), nreducers };
+    if (part.outs == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    init_words(&counts);
+    for (int i = id; i < nfiles; i += nmappers) {
+        FILE *fp = fopen(files[i], "r");
+        if (fp == NULL) {
+            perror(files[i]);
+            continue;
+        }
+        count_words(&counts, fp);
+        fclose(fp);
+    }
+
+    for (int r = 0; r < nreducers; r++)
+        part.outs[r] = fdopen(pipes[id * nreducers + r][1], "w");
+    foreach_word(&counts, partition_word, &part);
+    for (int r = 0; r < nreducers; r++)
+        fclose(part.outs[r]); // reducer r sees EOF once every mapper is done
+    exit(EXIT_SUCCESS);
+}
+
+/*
+ * Body of reducer id: merge the counts from every mapper, then send them to
+ * the parent on outfd sorted, or only the top of them, as fprint_words and
+ * fprint_top_words print them.
+ */
+static void run_reducer(int id, int nmappers, int nreducers, int (*pipes)[2],
+                        int outfd, long top) {
+    word_count_list_t counts;
+    struct child *inputs = calloc(nmappers, sizeof(struct child));
+    struct pollfd *fds = calloc(nmappers, sizeof(struct pollfd));
+    if (inputs == NULL || fds == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    init_words(&counts);
+    for (int m = 0; m < nmappers; m++)
+        inputs[m].fd = pipes[m * nreducers + id][0];
+    int running = nmappers;
+    while (running > 0)
+        running = poll_children(&counts, inputs, fds, running);
+
+    FILE *out = fdopen(outfd, "w");
+    if (top > 0) {
+        fprint_top_words(&counts, top, less_count, out);
+    } else {
+        STATS_BEGIN(sort);
+        wordcount_sort(&counts, less_count);
+        STATS_END(STAT_SORT, sort);
+        fprint_words(&counts, out);
+    }
+    fclose(out);
+    exit(EXIT_SUCCESS);
+}
+
+/* One reducer's sorted output, read back a record at a time. */
+struct share {
+    FILE *in;
+    char *line;
+    size_t cap;
+    word_count_t head; /* The record last read; its word is in line. */
+};
+
+/* Read the next record of a share into its head. Returns false at EOF. */
+static bool next_record(struct share *sh) {
+    ssize_t len;
+    while ((len = getline(&sh->line, &sh->cap, sh->in)) > 0) {
+        char *tab;
+        long count = strtol(sh->line, &tab, 10);
+        if (tab == sh->line || *tab != '\t' || sh->line[len - 1] != '\n') {
+            fprintf(stderr, "read ill-formed count\n");
+            continue;
+        }
+        sh->line[len - 1] = '\0';
+        sh->head.count = count;
+        sh->head.word = tab + 1;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Print the records of the sorted shares[0..nshares) merged into one sorted
+ * sequence, closing each share once it is used up.
+ */
+static void print_merged(struct share *shares, int nshares, FILE *outfile) {
+    struct word_emitter em;
+    int live = 0;
+    for (int i = 0; i < nshares; i++) {
+        if (next_record(&shares[i])) {
+            shares[live++] = shares[i];
+        } else {
+            fclose(shares[i].in);
+            free(shares[i].line);
+        }
+    }
+
+    emit_init(&em, outfile);
+    while (live > 0) {
+        // the shares are disjoint, so the least head is the next record
+        int min = 0;
+        for (int i = 1; i < live; i++)
+            if (less_count(&shares[i].head, &shares[min].head))
+                min = i;
+        emit_word(&em, shares[min].head.count, shares[min].head.word);
+        if (!next_record(&shares[min])) {
+            fclose(shares[min].in);
+            free(shares[min].line);
+            shares[min] = shares[--live];
+        }
+    }
+    emit_finish(&em);
+}
+
+/*
+ * Count files[0..nfiles) with nmappers mappers and nreducers reducers. With
+ * top 0 the result is printed here, straight from the merge; otherwise each
+ * reducer's top entries are collected into wclist for the caller to print.
+ */
+static void map_reduce(word_count_list_t *wclist, char **files, int nfiles,
+                       int nmappers, int nreducers, long top) {
+    if (nreducers > INT_MAX / nmappers) {
+        fprintf(stderr, "too many mappers and reducers\n");
+        exit(EXIT_FAILURE);
+    }
+    int npipes = nmappers * nreducers;
+    int (*pipes)[2] = calloc(npipes, sizeof(int[2]));
+    struct share *shares = calloc(nreducers, sizeof(struct share));
+    pid_t *pids = calloc(nmappers + nreducers, sizeof(pid_t));
+    if (pipes == NULL || shares == NULL || pids == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < npipes; i++) {
+        if (pipe(pipes[i]) == -1) {
+            perror("pipe");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (int r = 0; r < nreducers; r++) {
+        int outfd[2];
+        if (pipe(outfd) == -1 || (pids[r] = fork()) == -1) {
+            perror("could not start reducer");
+            exit(EXIT_FAILURE);
+        }
+        if (pids[r] == 0) {
+            close(outfd[0]);
+            close_pipes(pipes, npipes, reducer_end, r, nreducers);
+            run_reducer(r, nmappers, nreducers, pipes, outfd[1], top);
+        }
+        close(outfd[1]);
+        shares[r].in = fdopen(outfd[0], "r");
+    }
+    for (int m = 0; m < nmappers; m++) {
+        if ((pids[nreducers + m] = fork()) == -1) {
+            perror("could not start mapper");
+            exit(EXIT_FAILURE);
+        }
+        if (pids[nreducers + m] == 0) {
+            close_pipes(pipes, npipes, mapper_end, m, nreducers);
+            run_mapper(files, nfiles, m, nmappers, nreducers, pipes);
+        }
+    }
+    // only the children use these; the parent's copies would hide EOF
+    for (int i = 0; i < npipes; i++) {
+        close(pipes[i][0]);
+        close(pipes[i][1]);
+    }
+
+    if (top == 0) {
+        STATS_BEGIN(print);
+        print_merged(shares, nreducers, stdout);
+        STATS_END(STAT_PRINT, print);
+    } else {
+        for (int r = 0; r < nreducers; r++) {
+            while (next_record(&shares[r]))
+                add_word_copy_with_count(wclist, shares[r].head.word,
+                                         strlen(shares[r].head.word),
+                                         shares[r].head.count);
+            fclose(shares[r].in);
+            free(shares[r].line);
+        }
     }
+
+    // reap every child, don't care about exit status
+    for (int i = 0; i < nmappers + nreducers; i++)
+        waitpid(pids[i], NULL, 0);
+    free(pids);
+    free(shares);
+    free(pipes);
 }
 
 /*
  * main - handle command line, spawning one process per file.
+ *
+ * Up to -p N children (by default one per online CPU) run at once. The
+ * parent polls all of their pipes and merges counts as they arrive. Counts
+ * travel as binary records unless -t asks for the readable text format.
+ * With -k N, only the N most frequent words are printed. With -u, words are
+ * runs of UTF-8 letters, case folded; -U leaves the case of non-ASCII letters
+ * alone. With -v, time spent in each phase is reported on stderr at exit, by
+ * each child for its own file as well as by the parent.
+ *
+ * With -r N, counting runs as a map/reduce instead (see map_reduce): up to
+ * -p mappers split the files between them and N reducers each merge and
+ * sort a share of the words.
+ *
+ * With -a, counts are approximate and memory is fixed: each child sends a
+ * word_sketch of its file, the parent merges them, and the -k N (by default
+ * 10) most frequent words are printed with estimated counts. -r does not
+ * apply.
  */
 int main(int argc, char *argv[]) {
+    long max_children = sysconf(_SC_NPROCESSORS_ONLN);
+    long reducers = 0;
+    long top = 0;
+    bool approx = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "ak:p:r:tuUv")) != -1) {
+        switch (opt) {
+        case 'a':
+            approx = true;
+            break;
+        case 'k':
+            if (!parse_long_arg(optarg, 0, &top)) {
+                fprintf(stderr, "%s: -k takes a count of 0 or more\n", argv[0]);
+                return 1;
+            }
+            break;
+        case 'p':
+            if (!parse_long_arg(optarg, 1, &max_children) || max_children > INT_MAX) {
+                fprintf(stderr, "%s: -p takes a count of 1 or more\n", argv[0]);
+                return 1;
+            }
+            break;
+        case 'r':
+            if (!parse_long_arg(optarg, 1, &reducers) || reducers > INT_MAX) {
+                fprintf(stderr, "%s: -r takes a count of 1 or more\n", argv[0]);
+                return 1;
+            }
+            break;
+        case 't':
+            text_records = true;
+            break;
+        case 'u':
+            set_word_encoding(WORDS_UTF8_FOLD);
+            break;
+        case 'U':
+            set_word_encoding(WORDS_UTF8);
+            break;
+        case 'v':
+            stats_enable();
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-a] [-k top] [-p children] [-r reducers] [-t] [-u|-U] [-v] [file ...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (max_children < 1)
+        max_children = 1;
+
+    struct word_sketch parent_sketch;
+    if (approx) {
+        if (top == 0)
+            top = 10;
+        if (!sketch_init(&parent_sketch, SKETCH_TRACKED(top))) {
+            perror("could not allocate sketch");
+            return 1;
+        }
+        sketch = &parent_sketch;
+    }
+
     /* Create the empty data structure. */
     word_count_list_t word_counts;
     init_words(&word_counts);
 
-    if (argc <= 1) {
+    if (optind >= argc && approx) {
+        count_words_sketch(sketch, stdin);
+    } else if (optind >= argc) {
         /* Process stdin in a single process. */
         count_words(&word_counts, stdin);
-    } 
-    else {
-        for (int i = 1; i < argc; i++) {
-            // create a pipe for communication between parent and child.
-            // pipefd[0] is the read end, pipefd[1] is the write end.
-            // the child will write word counts to the pipe, and the parent will read them back
-
-            // each child gets its own pipe
-            int pipefd[2];
-            if (pipe(pipefd) == -1) {
-                perror("pipe");
-                exit(EXIT_FAILURE);
-            }
-            
-            // fork a new child process
-            pid_t pid = fork();
-            if (pid == -1) {
-                perror("fork");
-                exit(EXIT_FAILURE);
-            }
-            
-            if (pid == 0) {
-                // child process: counts words in one file
-                // close the read end of the pipe (child only writes)
-                close(pipefd[0]);
-                
-                // open the file assigned to this child
-                FILE *fp = fopen(argv[i], "r");
-                if (fp == NULL) {
-                    perror("could not open file");
-                    exit(EXIT_FAILURE);
-                }
-                
-                // count words in this file
-                word_count_list_t child_counts;
-                init_words(&child_counts);
-                count_words(&child_counts, fp);
-                fclose(fp);
-                
-                // write the word counts to the pipe
-                FILE *pipe_stream = fdopen(pipefd[1], "w");
-                fprint_words(&child_counts, pipe_stream);
-                fclose(pipe_stream); // also closes pipefd[1]
-                
-                // exit child process
-                exit(EXIT_SUCCESS);
-                
-            } else {
-                // parent process: collects results from child
-                
-                // close the write end of the pipe
-                close(pipefd[1]);
-                
-                // convert the pipe's read end into a FILE* stream.
-                FILE *pipe_stream = fdopen(pipefd[0], "r");
-                merge_counts(&word_counts, pipe_stream);
-                fclose(pipe_stream);  // also closes pipefd[0]
-                
-                // wait for child to finish, don't care about exit status
-                wait(NULL);
-            }
+    } else if (reducers > 0 && !approx) {
+        int nfiles = argc - optind;
+        map_reduce(&word_counts, argv + optind, nfiles,
+                   max_children < nfiles ? max_children : nfiles, reducers, top);
+        if (top == 0) {
+            // already printed while merging the reducers' output
+            free_words(&word_counts);
+            return 0;
+        }
+    } else {
+        // no point in more children than there are files
+        if (max_children > argc - optind)
+            max_children = argc - optind;
+        struct child *children = calloc(max_children, sizeof(struct child));
+        struct pollfd *fds = calloc(max_children, sizeof(struct pollfd));
+        if (children == NULL || fds == NULL) {
+            perror("calloc");
+            return 1;
+        }
+        int running = 0;
+        int next = optind;
+
+        while (running > 0 || next < argc) {
+            // keep up to max_children children in flight
+            while (running < max_children && next < argc)
+                start_child(&children[running++], argv[next++]);
+
+            running = poll_children(&word_counts, children, fds, running);
         }
+
+        free(fds);
+        free(children);
     }
 
     /* Output final result of all process' work. */
-    wordcount_sort(&word_counts, less_count);
-    fprint_words(&word_counts, stdout);
+    if (approx) {
+        sketch_fprint_top(sketch, top, stdout);
+        sketch_free(sketch);
+    } else if (top > 0) {
+        fprint_top_words(&word_counts, top, less_count, stdout);
+    } else {
+        STATS_BEGIN(sort);
+        wordcount_sort(&word_counts, less_count);
+        STATS_END(STAT_SORT, sort);
+        STATS_BEGIN(print);
+        fprint_words(&word_counts, stdout);
+        STATS_END(STAT_PRINT, print);
+    }
+    free_words(&word_counts);
     return 0;
 }
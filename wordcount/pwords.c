@@ -1,5 +1,5 @@
 /*
- * Word count application with one thread per input file.
+ * Word count application with a pool of worker threads.
  *
  * You may modify this file in any way you like, and are expected to modify it.
  * Your solution must read each input file from a separate thread. We encourage
@@ -23,70 +23,372 @@
  */
 
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <pthread.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "word_count.h"
 #include "word_helpers.h"
+#include "word_stats.h"
 
-struct thread_args {
+/* Files larger than this are split into ranges of about this many bytes. */
+#ifndef CHUNK_SIZE
+#define CHUNK_SIZE (16 << 20)
+#endif
+
+/* With -a, a range is added to the sketch as a single batch. */
+_Static_assert(CHUNK_SIZE <= SKETCH_BATCH, "a range must fit in one sketch batch");
+
+/* A whole file (end < 0) or the words starting in bytes [start, end) of one. */
+struct work_item {
     char *filename;
+    off_t start;
+    off_t end;
+};
+
+/*
+ * Per-worker double-ended queue. The owner takes work from the tail and idle
+ * workers steal from the head, so a thief takes the item the owner would
+ * have reached last.
+ */
+struct work_deque {
+    pthread_mutex_t lock;
+    struct work_item *items;
+    size_t head;
+    size_t tail;
+    size_t cap;
+};
+
+struct work_pool {
+    struct work_deque *deques;
+    int num_workers;
+};
+
+struct thread_args {
+    struct work_pool *pool;
+    int id;
     word_count_list_t *wclist;
+    struct word_sketch *sketch; /* With -a, counts go here instead. */
 };
 
-/* thread function to process one file */
-void *process_file(void *args) {
+static void deque_push(struct work_deque *dq, struct work_item item) {
+    if (dq->tail == dq->cap) {
+        dq->cap = dq->cap ? dq->cap * 2 : 16;
+        dq->items = realloc(dq->items, dq->cap * sizeof(struct work_item));
+        if (dq->items == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    dq->items[dq->tail++] = item;
+}
+
+/* Takes an item from the tail (owner) or head (thief) of a deque. */
+static bool deque_take(struct work_deque *dq, bool steal, struct work_item *item) {
+    bool found = false;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->head < dq->tail) {
+        *item = steal ? dq->items[dq->head++] : dq->items[--dq->tail];
+        found = true;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+/*
+ * Finds the next item for worker id: its own work first, then work stolen
+ * from the other workers in turn. All work is queued before the workers
+ * start, so once every deque is empty there is nothing left to do.
+ */
+static bool next_work(struct work_pool *pool, int id, struct work_item *item) {
+    if (deque_take(&pool->deques[id], false, item))
+        return true;
+    for (int i = 1; i < pool->num_workers; i++) {
+        if (deque_take(&pool->deques[(id + i) % pool->num_workers], true, item))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Queues every file named in files[0..n), splitting large ones into ranges,
+ * and deals the items round-robin across the workers' deques.
+ */
+static size_t queue_files(struct work_pool *pool, char **files, int n) {
+    size_t queued = 0;
+    for (int i = 0; i < n; i++) {
+        struct stat st;
+        struct work_item item = { files[i], 0, -1 };
+        FILE *fp;
+        if (stat(files[i], &st) == 0 && S_ISREG(st.st_mode) && st.st_size > CHUNK_SIZE &&
+            (fp = fopen(files[i], "r")) != NULL) {
+            // cut at word boundaries so no word spans two ranges
+            for (off_t start = 0; start < st.st_size; start = item.end) {
+                item.start = start;
+                item.end = start + CHUNK_SIZE < st.st_size
+                    ? word_boundary(fp, start + CHUNK_SIZE) : st.st_size;
+                deque_push(&pool->deques[queued++ % pool->num_workers], item);
+            }
+            fclose(fp);
+        } else {
+            deque_push(&pool->deques[queued++ % pool->num_workers], item);
+        }
+    }
+    return queued;
+}
+
+/* thread function to process work items until none are left */
+void *process_work(void *args) {
     struct thread_args *ta = (struct thread_args *)args; // cast argument back to thread_args
-    FILE *fp = fopen(ta->filename, "r");
-    if (fp == NULL) {
-        perror("Could not open file");
-        return NULL;
+    struct work_item item;
+    while (next_work(ta->pool, ta->id, &item)) {
+        FILE *fp = fopen(item.filename, "r");
+        if (fp == NULL) {
+            perror("Could not open file");
+            continue;
+        }
+        if (ta->sketch != NULL && item.end < 0) {
+            count_words_sketch(ta->sketch, fp);
+        } else if (ta->sketch != NULL) {
+            // a range is no bigger than a sketch batch: count it in one
+            word_count_list_t batch;
+            init_words_local(&batch);
+            count_words_range(&batch, fp, item.start, item.end);
+            sketch_words(ta->sketch, &batch);
+            free_words(&batch);
+        } else if (item.end < 0) {
+            count_words(ta->wclist, fp);
+        } else {
+            count_words_range(ta->wclist, fp, item.start, item.end);
+        }
+        fclose(fp);
     }
-    count_words(ta->wclist, fp);
-    fclose(fp);
+    return NULL;
+}
+
+struct merge_args {
+    word_count_list_t *dst;
+    word_count_list_t *src;
+};
+
+/* thread function to fold one list into another */
+void *merge_lists(void *args) {
+    struct merge_args *ma = (struct merge_args *)args;
+    merge_words(ma->dst, ma->src);
     return NULL;
 }
 
 /*
- * main - handle command line, spawning one thread per file.
+ * Merges lists[0..n) into lists[0] as a binary tree: each round folds pairs
+ * of lists together in parallel, halving the number left.
+ */
+static void tree_merge(word_count_list_t *lists, int n) {
+    pthread_t *threads = malloc((n / 2 + 1) * sizeof(pthread_t));
+    struct merge_args *args = malloc((n / 2 + 1) * sizeof(struct merge_args));
+
+    for (int stride = 1; stride < n; stride *= 2) {
+        int pairs = 0;
+        for (int i = 0; i + stride < n; i += 2 * stride) {
+            args[pairs].dst = &lists[i];
+            args[pairs].src = &lists[i + stride];
+            if (pthread_create(&threads[pairs], NULL, merge_lists, &args[pairs]) != 0) {
+                perror("ERROR creating thread");
+                exit(1);
+            }
+            pairs++;
+        }
+        for (int i = 0; i < pairs; i++)
+            pthread_join(threads[i], NULL);
+    }
+
+    free(args);
+    free(threads);
+}
+
+/* Allocates n empty sketches tracking enough words for the top k, or exits. */
+static struct word_sketch *alloc_sketches(int n, long top) {
+    struct word_sketch *sketches = malloc(n * sizeof(struct word_sketch));
+    for (int i = 0; i < n; i++) {
+        if (sketches == NULL || !sketch_init(&sketches[i], SKETCH_TRACKED(top))) {
+            perror("could not allocate sketch");
+            exit(1);
+        }
+    }
+    return sketches;
+}
+
+/*
+ * main - handle command line, spawning a fixed pool of worker threads.
+ *
+ * With -j N, the pool has N workers instead of one per online CPU. With -l,
+ * each worker counts into its own unlocked list and the lists are merged once
+ * all files have been read. With -k N, only the N most frequent words are
+ * printed. With -u, words are runs of UTF-8 letters, case folded; -U leaves
+ * the case of non-ASCII letters alone. With -v, time spent in each phase and
+ * on the list locks is reported on stderr at exit.
+ *
+ * With -a, counts are approximate and memory is fixed: each worker keeps a
+ * word_sketch instead of adding to a list, the sketches are merged once
+ * all files have been read, and the -k N (by default 10) most frequent
+ * words are printed with estimated counts.
  */
 int main(int argc, char *argv[]) {
+    bool local = false;
+    bool approx = false;
+    long top = 0;
+    long num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    while ((opt = getopt(argc, argv, "aj:k:luUv")) != -1) {
+        switch (opt) {
+        case 'a':
+            approx = true;
+            break;
+        case 'j':
+            if (!parse_long_arg(optarg, 1, &num_workers) || num_workers > INT_MAX) {
+                fprintf(stderr, "%s: -j takes a count of 1 or more\n", argv[0]);
+                return 1;
+            }
+            break;
+        case 'k':
+            if (!parse_long_arg(optarg, 0, &top)) {
+                fprintf(stderr, "%s: -k takes a count of 0 or more\n", argv[0]);
+                return 1;
+            }
+            break;
+        case 'l':
+            local = true;
+            break;
+        case 'u':
+            set_word_encoding(WORDS_UTF8_FOLD);
+            break;
+        case 'U':
+            set_word_encoding(WORDS_UTF8);
+            break;
+        case 'v':
+            stats_enable();
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-a] [-j workers] [-k top] [-l] [-u|-U] [-v] [file ...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (num_workers < 1)
+        num_workers = 1;
+    if (approx && top == 0)
+        top = 10;
+
     /* Create the empty data structure. */
     word_count_list_t word_counts;
+    word_count_list_t *result = &word_counts;
+    word_count_list_t *locals = NULL;
+    struct word_sketch *sketches = NULL;
+    int nsketches = 0;
     init_words(&word_counts);
 
-    if (argc <= 1) {
+    if (optind >= argc && approx) {
+        nsketches = 1;
+        sketches = alloc_sketches(nsketches, top);
+        count_words_sketch(&sketches[0], stdin);
+    } else if (optind >= argc) {
         /* Process stdin in a single thread. */
         count_words(&word_counts, stdin);
     } else {
-        int num_threads = argc - 1;
-        pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
-        struct thread_args *args = malloc(num_threads * sizeof(struct thread_args));
-        
-        // create threads to process each file
-        for (int i = 0; i < num_threads; i++) {
-            args[i].filename = argv[i + 1];
-            args[i].wclist = &word_counts; // pass pointer to shared word count list
-            
-            if (pthread_create(&threads[i], NULL, process_file, &args[i]) != 0) {
+        struct work_pool pool;
+        pool.num_workers = num_workers;
+        pool.deques = calloc(num_workers, sizeof(struct work_deque));
+        if (pool.deques == NULL) {
+            perror("calloc");
+            exit(1);
+        }
+        for (int i = 0; i < num_workers; i++)
+            pthread_mutex_init(&pool.deques[i].lock, NULL);
+
+        // no point in running more workers than there are work items
+        size_t queued = queue_files(&pool, argv + optind, argc - optind);
+        if ((size_t)num_workers > queued)
+            num_workers = queued;
+
+        // one sketch per worker that will actually run
+        if (approx) {
+            nsketches = num_workers;
+            sketches = alloc_sketches(nsketches, top);
+        }
+
+        pthread_t *threads = malloc(num_workers * sizeof(pthread_t));
+        struct thread_args *args = malloc(num_workers * sizeof(struct thread_args));
+        if (threads == NULL || args == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+
+        if (local) {
+            // hash-table shards are aligned past what malloc guarantees
+            if ((errno = posix_memalign((void **)&locals, __alignof__(word_count_list_t),
+                                        num_workers * sizeof(word_count_list_t))) != 0) {
+                perror("posix_memalign");
+                exit(1);
+            }
+            for (int i = 0; i < num_workers; i++)
+                init_words_local(&locals[i]);
+        }
+
+        // create the workers
+        for (int i = 0; i < num_workers; i++) {
+            args[i].pool = &pool;
+            args[i].id = i;
+            // pass pointer to the worker's own list, or the shared one
+            args[i].wclist = local ? &locals[i] : &word_counts;
+            args[i].sketch = approx ? &sketches[i] : NULL;
+
+            if (pthread_create(&threads[i], NULL, process_work, &args[i]) != 0) {
                 perror("ERROR creating thread");
                 exit(1);
             }
         }
-        
-        // wait for all threads to complete
-        for (int i = 0; i < num_threads; i++)
+
+        // wait for all workers to run out of work
+        for (int i = 0; i < num_workers; i++)
             pthread_join(threads[i], NULL);
 
+        // merging leaves every other list empty
+        if (local) {
+            tree_merge(locals, num_workers);
+            result = &locals[0];
+        }
+
+        for (int i = 0; i < pool.num_workers; i++)
+            free(pool.deques[i].items);
+        free(pool.deques);
         free(args);
         free(threads);
     }
 
     /* Output final result of all threads' work. */
-    wordcount_sort(&word_counts, less_count);
-    fprint_words(&word_counts, stdout);
+    if (approx) {
+        for (int i = 1; i < nsketches; i++) {
+            sketch_merge(&sketches[0], &sketches[i]);
+            sketch_free(&sketches[i]);
+        }
+        sketch_fprint_top(&sketches[0], top, stdout);
+        sketch_free(&sketches[0]);
+        free(sketches);
+    } else if (top > 0) {
+        fprint_top_words(result, top, less_count, stdout);
+    } else {
+        STATS_BEGIN(sort);
+        wordcount_sort(result, less_count);
+        STATS_END(STAT_SORT, sort);
+        STATS_BEGIN(print);
+        fprint_words(result, stdout);
+        STATS_END(STAT_PRINT, print);
+    }
+    free_words(result);
+    free(locals);
     return 0;
 }
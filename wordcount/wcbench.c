@@ -0,0 +1,352 @@
+/*
+ * Benchmark driver for the word count applications. Generates synthetic
+ * corpora with Zipf-distributed vocabularies, then runs each application
+ * over them and over the gutenberg texts, printing one CSV row per run.
+ *
+ * usage: wcbench [-r reps] [-d dir] [-s scale] [-t secs] [program ...]
+ *
+ * Programs default to every word count application in the current
+ * directory. Corpora are written to dir (by default a fresh directory under
+ * /tmp, removed afterwards); -s multiplies their sizes. A run is stopped
+ * once it has used -t seconds of CPU time, since the list-based
+ * applications take time quadratic in the vocabulary, and its row is marked
+ * "timeout".
+ */
+
+/*
+ * Copyright (C) 2019 University of California, Berkeley
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <signal.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/* A set of input files handed to every program in one run. */
+struct corpus {
+    const char *name;
+    char **files;
+    int nfiles;
+    long long bytes;
+    long long words;
+    bool generated;
+};
+
+/* A synthetic corpus: nfiles files of about size bytes each. */
+struct zipf_spec {
+    const char *name;
+    int nfiles;
+    long size;
+    int vocab;
+    double exponent;
+};
+
+static const struct zipf_spec zipf_specs[] = {
+    { "zipf-1x4M", 1, 4 << 20, 20000, 1.0 },
+    { "zipf-16x256K", 16, 256 << 10, 20000, 1.0 },
+    { "zipf-256x16K", 256, 16 << 10, 5000, 1.1 },
+    { "zipf-flat-1x2M", 1, 2 << 20, 100000, 0.6 },
+};
+
+static const char *default_programs[] = {
+    "./words", "./lwords", "./pwords", "./fwords",
+    "./hwords", "./hpwords", "./hfwords",
+};
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+/* xorshift64*: fast, and the same corpora on every run. */
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Counts the runs of letters in a file, the way the applications split words. */
+static long long count_file_words(const char *path, long long *bytes) {
+    FILE *fp = fopen(path, "r");
+    long long words = 0;
+    bool in_word = false;
+    int ch;
+    if (fp == NULL) {
+        perror(path);
+        return 0;
+    }
+    while ((ch = getc(fp)) != EOF) {
+        bool alpha = isalpha(ch);
+        words += alpha && !in_word;
+        in_word = alpha;
+        (*bytes)++;
+    }
+    fclose(fp);
+    return words;
+}
+
+/*
+ * Writes the files of a synthetic corpus to dir. Word ranks are drawn from a
+ * Zipf distribution over a vocabulary of random lowercase words.
+ */
+static void make_zipf_corpus(struct corpus *c, const struct zipf_spec *spec,
+                             const char *dir, double scale) {
+    char **vocab = malloc(spec->vocab * sizeof(char *));
+    double *cdf = malloc(spec->vocab * sizeof(double));
+    double total = 0;
+    long size = spec->size * scale;
+
+    if (vocab == NULL || cdf == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    for (int i = 0; i < spec->vocab; i++) {
+        int len = 2 + rng_next() % 9;
+        vocab[i] = malloc(len + 1);
+        for (int j = 0; j < len; j++)
+            vocab[i][j] = 'a' + rng_next() % 26;
+        vocab[i][len] = '\0';
+        total += 1.0 / pow(i + 1, spec->exponent);
+        cdf[i] = total;
+    }
+
+    c->name = spec->name;
+    c->nfiles = spec->nfiles;
+    c->files = malloc(spec->nfiles * sizeof(char *));
+    c->bytes = 0;
+    c->words = 0;
+    c->generated = true;
+    for (int f = 0; f < spec->nfiles; f++) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s.%d.txt", dir, spec->name, f);
+        c->files[f] = strdup(path);
+        FILE *fp = fopen(path, "w");
+        if (fp == NULL) {
+            perror(path);
+            exit(1);
+        }
+        long written = 0;
+        for (int n = 1; written < size; n++) {
+            // binary search for the rank whose cdf covers u
+            double u = (rng_next() >> 11) * (1.0 / 9007199254740992.0) * total;
+            int lo = 0, hi = spec->vocab - 1;
+            while (lo < hi) {
+                int mid = (lo + hi) / 2;
+                if (cdf[mid] < u)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            written += fprintf(fp, "%s%c", vocab[lo], n % 12 ? ' ' : '\n');
+            c->words++;
+        }
+        c->bytes += written;
+        fclose(fp);
+    }
+
+    for (int i = 0; i < spec->vocab; i++)
+        free(vocab[i]);
+    free(vocab);
+    free(cdf);
+}
+
+/*
+ * Runs prog over a corpus once, limited to cpu_limit seconds of CPU time,
+ * and prints the CSV row for the run.
+ */
+static void run_once(const char *prog, struct corpus *c, int rep, int cpu_limit) {
+    char **argv = malloc((c->nfiles + 2) * sizeof(char *));
+    struct rusage ru;
+    int status;
+
+    argv[0] = (char *) prog;
+    memcpy(argv + 1, c->files, c->nfiles * sizeof(char *));
+    argv[c->nfiles + 1] = NULL;
+
+    double start = now();
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        // SIGXCPU at the soft limit; the hard one only backs it up with SIGKILL
+        struct rlimit rl = { cpu_limit, cpu_limit + 1 };
+        setrlimit(RLIMIT_CPU, &rl);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        execv(prog, argv);
+        perror(prog);
+        _exit(127);
+    }
+    if (wait4(pid, &status, 0, &ru) == -1) {
+        perror("wait4");
+        exit(1);
+    }
+    double wall = now() - start;
+    free(argv);
+
+    const char *result = "ok";
+    if (WIFSIGNALED(status) && WTERMSIG(status) == SIGXCPU)
+        result = "timeout";
+    else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        result = "failed";
+    double user = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+    double sys = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    // ru_maxrss is in kilobytes on Linux, and is never below wcbench's own
+    // footprint at the fork, since it carries over through exec
+    printf("%s,%s,%d,%s,%d,%lld,%lld,%.4f,%.4f,%.4f,%ld,%.0f\n", c->name, prog,
+           rep, result, c->nfiles, c->bytes, c->words, wall, user, sys,
+           ru.ru_maxrss, c->words / wall);
+    fflush(stdout);
+}
+
+/* Parses a whole decimal count of at least 1 into *n, or returns false. */
+static bool parse_count(const char *arg, int *n) {
+    char *end;
+    long value;
+    errno = 0;
+    value = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || errno != 0 || value < 1 || value > INT_MAX)
+        return false;
+    *n = value;
+    return true;
+}
+
+/* Parses a finite number greater than 0 into *x, or returns false. */
+static bool parse_scale(const char *arg, double *x) {
+    char *end;
+    double value;
+    errno = 0;
+    value = strtod(arg, &end);
+    if (end == arg || *end != '\0' || errno != 0 || !(value > 0) || isinf(value))
+        return false;
+    *x = value;
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    const char **programs = default_programs;
+    int nprograms = sizeof(default_programs) / sizeof(default_programs[0]);
+    int reps = 3;
+    double scale = 1;
+    int cpu_limit = 60;
+    char *dir = NULL;
+    bool own_dir = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:r:s:t:")) != -1) {
+        switch (opt) {
+        case 'd':
+            dir = optarg;
+            break;
+        case 'r':
+            if (!parse_count(optarg, &reps)) {
+                fprintf(stderr, "%s: -r takes a count of 1 or more\n", argv[0]);
+                return 1;
+            }
+            break;
+        case 's':
+            if (!parse_scale(optarg, &scale)) {
+                fprintf(stderr, "%s: -s takes a scale greater than 0\n", argv[0]);
+                return 1;
+            }
+            break;
+        case 't':
+            if (!parse_count(optarg, &cpu_limit)) {
+                fprintf(stderr, "%s: -t takes a number of seconds of 1 or more\n", argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r reps] [-d dir] [-s scale] [-t secs] [program ...]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (optind < argc) {
+        programs = (const char **) argv + optind;
+        nprograms = argc - optind;
+    }
+    if (dir == NULL) {
+        static char tmpl[] = "/tmp/wcbench.XXXXXX";
+        if ((dir = mkdtemp(tmpl)) == NULL) {
+            perror("mkdtemp");
+            return 1;
+        }
+        own_dir = true;
+    }
+
+    int nzipf = sizeof(zipf_specs) / sizeof(zipf_specs[0]);
+    struct corpus *corpora = calloc(nzipf + 1, sizeof(struct corpus));
+    int ncorpora = 0;
+
+    glob_t g = { 0 };
+    if (glob("gutenberg/*.txt", 0, NULL, &g) == 0) {
+        struct corpus *c = &corpora[ncorpora++];
+        c->name = "gutenberg";
+        c->files = malloc(g.gl_pathc * sizeof(char *));
+        // leave out the reference outputs kept alongside the texts
+        for (size_t i = 0; i < g.gl_pathc; i++) {
+            if (strstr(g.gl_pathv[i], "_output") == NULL)
+                c->files[c->nfiles++] = g.gl_pathv[i];
+        }
+        for (int i = 0; i < c->nfiles; i++)
+            c->words += count_file_words(c->files[i], &c->bytes);
+    }
+    for (int i = 0; i < nzipf; i++)
+        make_zipf_corpus(&corpora[ncorpora++], &zipf_specs[i], dir, scale);
+
+    printf("corpus,program,rep,result,files,bytes,words,wall_s,user_s,sys_s,maxrss_kb,words_per_s\n");
+    for (int i = 0; i < ncorpora; i++) {
+        for (int p = 0; p < nprograms; p++) {
+            for (int r = 0; r < reps; r++)
+                run_once(programs[p], &corpora[i], r, cpu_limit);
+        }
+    }
+
+    // free the generated corpora's paths; their files are deleted only from
+    // our own temporary directory, and kept in a -d directory
+    for (int i = 0; i < ncorpora; i++) {
+        for (int f = 0; corpora[i].generated && f < corpora[i].nfiles; f++) {
+            if (own_dir)
+                unlink(corpora[i].files[f]);
+            free(corpora[i].files[f]);
+        }
+        free(corpora[i].files);
+    }
+    if (own_dir)
+        rmdir(dir);
+    globfree(&g);
+    free(corpora);
+    return 0;
+}
@@ -22,6 +22,8 @@
  */
 
 #include "word_count.h"
+#include "word_emit.h"
+#include "word_sort.h"
 
 void init_words(word_count_list_t *wclist) {
     /* Initialize word count.  */
@@ -39,37 +41,114 @@ size_t len_words(word_count_list_t *wclist) {
 
 word_count_t *find_word(word_count_list_t *wclist, char *word) {
     /* Return count for word, if it exists. */
+    uint32_t hash = word_hash(word);
     word_count_t *wc = *wclist;
-    while ((wc != NULL) && (strcmp(word, wc->word) != 0)) {
+    while ((wc != NULL) &&
+           (wc->hash != hash || strcmp(word, wc->word) != 0)) {
         wc = wc->next;
     }
     return wc;
 }
 
-word_count_t *add_word(word_count_list_t *wclist, char *word) {
+/* Inserts word, known to be absent, at the head of the list. */
+static word_count_t *push_word(word_count_list_t *wclist, char *word,
+                               uint32_t hash, int count) {
+    word_count_t *wc = malloc(sizeof(word_count_t));
+    if (wc == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    wc->word = word;
+    wc->count = count;
+    wc->hash = hash;
+    wc->next = *wclist;
+    *wclist = wc;
+    return wc;
+}
+
+word_count_t *add_word_with_count(word_count_list_t *wclist, char *word,
+                                  int count) {
     /*
-     * If word is present in word_counts list, increment the count.
-     * Otherwise, insert at head of list with count 1.
+     * If word is present in word_counts list, add to its count.
+     * Otherwise, insert at head of list with the given count.
      */
     word_count_t *wc = find_word(wclist, word);
     if (wc != NULL) {
-        wc->count++;
-    } else if ((wc = malloc(sizeof(word_count_t))) != NULL) {
-        wc->word = word;
-        wc->count = 1;
-        wc->next = *wclist;
-        *wclist = wc;
-    } else {
+        wc->count += count;
+        return wc;
+    }
+    return push_word(wclist, word, word_hash(word), count);
+}
+
+word_count_t *add_word(word_count_list_t *wclist, char *word) {
+    return add_word_with_count(wclist, word, 1);
+}
+
+word_count_t *add_word_copy_with_count(word_count_list_t *wclist,
+                                       const char *word, size_t len, int count) {
+    word_count_t *wc = find_word(wclist, (char *) word);
+    char *copy;
+    if (wc != NULL) {
+        wc->count += count;
+        return wc;
+    }
+    if ((copy = malloc(len + 1)) == NULL) {
         perror("malloc");
+        return NULL;
+    }
+    memcpy(copy, word, len + 1);
+    if ((wc = push_word(wclist, copy, word_hash(copy), count)) == NULL) {
+        free(copy);
     }
     return wc;
 }
 
+word_count_t *add_word_copy(word_count_list_t *wclist, const char *word,
+                            size_t len) {
+    return add_word_copy_with_count(wclist, word, len, 1);
+}
+
+void merge_words(word_count_list_t *dst, word_count_list_t *src) {
+    word_count_t *wc = *src;
+    while (wc != NULL) {
+        word_count_t *next = wc->next;
+        word_count_t *merged = add_word_with_count(dst, wc->word, wc->count);
+        if (merged == NULL || merged->word != wc->word) {
+            free(wc->word);
+        }
+        free(wc);
+        wc = next;
+    }
+    *src = NULL;
+}
+
+void free_words(word_count_list_t *wclist) {
+    word_count_t *wc = *wclist;
+    while (wc != NULL) {
+        word_count_t *next = wc->next;
+        free(wc->word);
+        free(wc);
+        wc = next;
+    }
+    *wclist = NULL;
+}
+
+void foreach_word(word_count_list_t *wclist,
+                  void fn(word_count_t *wc, void *aux), void *aux) {
+    word_count_t *wc;
+    for (wc = *wclist; wc != NULL; wc = wc->next) {
+        fn(wc, aux);
+    }
+}
+
 void fprint_words(word_count_list_t *wclist, FILE *outfile) {
+    struct word_emitter em;
     word_count_t *wc;
+    emit_init(&em, outfile);
     for (wc = *wclist; wc != NULL; wc = wc->next) {
-        fprintf(outfile, "%8d\t%s\n", wc->count, wc->word);
+        emit_word(&em, wc->count, wc->word);
     }
+    emit_finish(&em);
 }
 
 void wordcount_insert_ordered(word_count_list_t *wclist, word_count_t *elem,
@@ -92,14 +171,49 @@ void wordcount_insert_ordered(word_count_list_t *wclist, word_count_t *elem,
 
 void wordcount_sort(word_count_list_t *wclist,
                     bool less(const word_count_t *, const word_count_t *)) {
+    size_t len = len_words(wclist);
+    word_count_t **wcs;
+    word_count_t **tmp;
     word_count_t *head = *wclist;
-    word_count_list_t sorted;
-    init_words(&sorted);
-    while (head != NULL) {
-        word_count_t *to_insert = head;
-        head = head->next;
-        to_insert->next = NULL;
-        wordcount_insert_ordered(&sorted, to_insert, less);
-    }
-    *wclist = sorted;
+
+    if (len < 2) {
+        return;
+    }
+    wcs = malloc(len * sizeof(word_count_t *));
+    tmp = malloc(len * sizeof(word_count_t *));
+    if (wcs == NULL || tmp == NULL) {
+        /* Fall back to sorting the list in place, one insertion at a time. */
+        word_count_list_t sorted;
+        free(wcs);
+        free(tmp);
+        init_words(&sorted);
+        while (head != NULL) {
+            word_count_t *to_insert = head;
+            head = head->next;
+            to_insert->next = NULL;
+            wordcount_insert_ordered(&sorted, to_insert, less);
+        }
+        *wclist = sorted;
+        return;
+    }
+
+    /*
+     * Fill the array back to front: wordcount_insert_ordered puts an entry
+     * ahead of the ones equal to it, so a stable sort of the reversed list
+     * orders ties the same way.
+     */
+    for (size_t i = len; i > 0; head = head->next) {
+        wcs[--i] = head;
+    }
+    merge_sort(wcs, tmp, len, less);
+
+    /* Relink the nodes in sorted order. */
+    word_count_t **link = wclist;
+    for (size_t i = 0; i < len; i++) {
+        *link = wcs[i];
+        link = &wcs[i]->next;
+    }
+    *link = NULL;
+    free(wcs);
+    free(tmp);
 }
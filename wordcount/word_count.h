@@ -27,29 +27,116 @@
 #include <ctype.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 /*
  * Representation of a word count object and word count list object.
- * PINTOS_LIST and/or PTHREADS are #define'd prior to #include to select the
- * representations.
+ * HASH_TABLE or PINTOS_LIST, and optionally PTHREADS, are #define'd prior to
+ * #include to select the representations.
  */
 
-#ifdef PINTOS_LIST
+/*
+ * 64-bit FNV-1a hash of a NUL-terminated word. Entries keep the low half of
+ * it beside their count, so comparing a word against an entry that holds a
+ * different word rarely has to read the entry's string.
+ */
+static inline uint64_t word_hash(const char *word) {
+    uint64_t h = 14695981039346656037ULL;
+    while (*word != '\0') {
+        h ^= (unsigned char) *word++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+#if defined(HASH_TABLE)
+#include "arena.h"
+
+/*
+ * Records are allocated from an arena, with the word's bytes right after,
+ * so the hash, length, count and a short word share a cache line.
+ */
+typedef struct word_count {
+    char *word;
+    int count;
+    uint32_t hash; /* Low half of word_hash(word). */
+    uint32_t len;  /* strlen(word). */
+} word_count_t;
+
+/*
+ * Open-addressing hash table of word_count_t pointers with linear probing.
+ * cap is zero or a power of two; empty slots are NULL.
+ */
+struct word_table {
+    word_count_t **slots;
+    size_t cap;
+    size_t len;
+};
+
+#ifdef PTHREADS
+#include <pthread.h>
+
+/*
+ * Words are striped across WORD_SHARDS tables by hash, each with its own lock
+ * and arena, so threads adding different words rarely contend. Shards are
+ * padded to cache lines to keep their locks from sharing one.
+ */
+#define WORD_SHARDS 64
+struct word_shard {
+    pthread_mutex_t lock;
+    struct word_table table;
+    struct arena arena;
+} __attribute__((aligned(64)));
+#else /* PTHREADS */
+#define WORD_SHARDS 1
+struct word_shard {
+    struct word_table table;
+    struct arena arena;
+};
+#endif /* PTHREADS */
+
+typedef struct word_count_list {
+    struct word_shard shards[WORD_SHARDS];
+    word_count_t **sorted; /* Order set by wordcount_sort, or NULL. */
+    size_t sorted_len;     /* Entries in sorted; stale once the table grows. */
+#ifdef PTHREADS
+    bool local; /* Set by init_words_local: skip locking. */
+#endif /* PTHREADS */
+} word_count_list_t;
+
+#elif defined(PINTOS_LIST)
 #include "list.h"
 typedef struct word_count {
     char *word;
     int count;
+    uint32_t hash; /* Low half of word_hash(word). */
     struct list_elem elem;
 } word_count_t;
 
 #ifdef PTHREADS
 #include <pthread.h>
+
+/*
+ * Open-addressing table of a list's entries by hash, so that lookups need
+ * not walk the list. mask is the capacity minus one; empty slots are NULL.
+ * A table that has been replaced by a larger one is kept on retired until
+ * the list is freed, since a lookup may still be reading it.
+ */
+struct word_lookup {
+    word_count_t **slots;
+    size_t mask;
+    struct word_lookup *retired;
+};
+
 typedef struct word_count_list {
     struct list lst;
+    struct word_lookup *lookup; /* NULL until the first entry is added. */
+    size_t lookup_len;          /* Entries in lookup. */
     pthread_mutex_t lock;
+    bool local; /* Set by init_words_local: skip locking. */
 } word_count_list_t;
 #else /* PTHREADS */
 typedef struct list word_count_list_t;
@@ -60,15 +147,24 @@ typedef struct list word_count_list_t;
 typedef struct word_count {
     char *word;
     int count;
+    uint32_t hash; /* Low half of word_hash(word). */
     struct word_count *next;
 } word_count_t;
 
 typedef word_count_t *word_count_list_t;
-#endif /* PINTOS_LIST */
+#endif /* HASH_TABLE, PINTOS_LIST */
 
 /* Initialize a word count list. */
 void init_words(word_count_list_t *wclist);
 
+#ifdef PTHREADS
+/*
+ * Initialize a word count list that only one thread at a time will use, so
+ * operations on it skip locking.
+ */
+void init_words_local(word_count_list_t *wclist);
+#endif /* PTHREADS */
+
 /* Get length of a word count list. */
 size_t len_words(word_count_list_t *wclist);
 
@@ -88,6 +184,37 @@ word_count_t *add_word(word_count_list_t *wclist, char *word);
 word_count_t *add_word_with_count(word_count_list_t *wclist, char *word,
                                   int count);
 
+/*
+ * Insert a copy of word with count=1, if not already present; increment count
+ * if present. len is strlen(word). Does not take ownership of word, so callers
+ * can pass a scratch buffer and only new words are ever allocated.
+ */
+word_count_t *add_word_copy(word_count_list_t *wclist, const char *word,
+                            size_t len);
+
+/*
+ * Insert a copy of word with count, if not already present; increment count
+ * if present. len is strlen(word). Does not take ownership of word.
+ */
+word_count_t *add_word_copy_with_count(word_count_list_t *wclist,
+                                       const char *word, size_t len, int count);
+
+/*
+ * Move every word and its count from src into dst with add_word_with_count,
+ * leaving src empty.
+ */
+void merge_words(word_count_list_t *dst, word_count_list_t *src);
+
+/* Free every word and count in a word count list, leaving it empty. */
+void free_words(word_count_list_t *wclist);
+
+/*
+ * Call fn on every entry of a word count list, in the order fprint_words
+ * would print them. fn must not add words to the list.
+ */
+void foreach_word(word_count_list_t *wclist,
+                  void fn(word_count_t *wc, void *aux), void *aux);
+
 /* Print word counts to a file. */
 void fprint_words(word_count_list_t *wclist, FILE *outfile);
 
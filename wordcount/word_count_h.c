@@ -0,0 +1,340 @@
+/*
+ * Implementation of the word_count interface using an open-addressing hash
+ * table. Compiled with PTHREADS, the table is split into independently locked
+ * shards so it can be shared between threads.
+ */
+
+/*
+ * Copyright (C) 2019 University of California, Berkeley
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HASH_TABLE
+#error "HASH_TABLE must be #define'd when compiling word_count_h.c"
+#endif
+
+#include <stdint.h>
+
+#include "word_count.h"
+#include "word_emit.h"
+#include "word_sort.h"
+#include "word_stats.h"
+
+/* Number of slots allocated by a shard's first insertion. */
+#define TABLE_MIN_CAP 256
+
+#ifdef PTHREADS
+#define LOCK(wclist, shard)                                                    \
+    do {                                                                       \
+        if (!(wclist)->local)                                                  \
+            stats_mutex_lock(&(shard)->lock);                                  \
+    } while (0)
+#define UNLOCK(wclist, shard)                                                  \
+    do {                                                                       \
+        if (!(wclist)->local)                                                  \
+            pthread_mutex_unlock(&(shard)->lock);                              \
+    } while (0)
+#else
+#define LOCK(wclist, shard) ((void) 0)
+#define UNLOCK(wclist, shard) ((void) 0)
+#endif /* PTHREADS */
+
+/*
+ * Picks a shard from the upper half of the hash, leaving the low bits to pick a
+ * slot within the shard.
+ */
+static struct word_shard *shard_of(word_count_list_t *wclist, uint64_t hash) {
+#if WORD_SHARDS > 1
+    return &wclist->shards[(hash >> 32) % WORD_SHARDS];
+#else
+    return &wclist->shards[0];
+#endif
+}
+
+/* Returns true if wc holds the len-byte word whose hash is given. */
+static inline bool record_matches(const word_count_t *wc, const char *word,
+                                  size_t len, uint64_t hash) {
+    return wc->hash == (uint32_t) hash && wc->len == len &&
+           memcmp(wc->word, word, len) == 0;
+}
+
+/*
+ * Returns the slot holding word, or the empty slot where it belongs. The
+ * table must have at least one empty slot.
+ */
+static word_count_t **table_probe(struct word_table *table, const char *word,
+                                  size_t len, uint64_t hash) {
+    size_t mask = table->cap - 1;
+    size_t i = hash & mask;
+    while (table->slots[i] != NULL && !record_matches(table->slots[i], word, len, hash)) {
+        i = (i + 1) & mask;
+    }
+    return &table->slots[i];
+}
+
+/*
+ * Doubles the number of slots, moving every entry by its stored hash. Slots
+ * are picked by the low bits of the hash, which is the half records keep.
+ */
+static bool table_grow(struct word_table *table) {
+    size_t cap = table->cap ? table->cap * 2 : TABLE_MIN_CAP;
+    word_count_t **slots = calloc(cap, sizeof(word_count_t *));
+    if (slots == NULL) {
+        perror("calloc");
+        return false;
+    }
+    for (size_t i = 0; i < table->cap; i++) {
+        word_count_t *wc = table->slots[i];
+        if (wc != NULL) {
+            size_t j = wc->hash & (cap - 1);
+            while (slots[j] != NULL) {
+                j = (j + 1) & (cap - 1);
+            }
+            slots[j] = wc;
+        }
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->cap = cap;
+    return true;
+}
+
+/* Locks every shard, in index order so that two callers cannot deadlock. */
+static void lock_all(word_count_list_t *wclist) {
+    for (int i = 0; i < WORD_SHARDS; i++) {
+        LOCK(wclist, &wclist->shards[i]);
+    }
+}
+
+static void unlock_all(word_count_list_t *wclist) {
+    for (int i = WORD_SHARDS - 1; i >= 0; i--) {
+        UNLOCK(wclist, &wclist->shards[i]);
+    }
+}
+
+/* Total entries across shards. Caller holds every shard lock. */
+static size_t total_len(word_count_list_t *wclist) {
+    size_t len = 0;
+    for (int i = 0; i < WORD_SHARDS; i++) {
+        len += wclist->shards[i].table.len;
+    }
+    return len;
+}
+
+void init_words(word_count_list_t *wclist) {
+    for (int i = 0; i < WORD_SHARDS; i++) {
+        struct word_shard *shard = &wclist->shards[i];
+        shard->table.slots = NULL;
+        shard->table.cap = 0;
+        shard->table.len = 0;
+        arena_init(&shard->arena);
+#ifdef PTHREADS
+        pthread_mutex_init(&shard->lock, NULL);
+#endif /* PTHREADS */
+    }
+    wclist->sorted = NULL;
+    wclist->sorted_len = 0;
+#ifdef PTHREADS
+    wclist->local = false;
+#endif /* PTHREADS */
+}
+
+#ifdef PTHREADS
+void init_words_local(word_count_list_t *wclist) {
+    init_words(wclist);
+    wclist->local = true;
+}
+#endif /* PTHREADS */
+
+size_t len_words(word_count_list_t *wclist) {
+    lock_all(wclist);
+    size_t len = total_len(wclist);
+    unlock_all(wclist);
+    return len;
+}
+
+word_count_t *find_word(word_count_list_t *wclist, char *word) {
+    uint64_t hash = word_hash(word);
+    struct word_shard *shard = shard_of(wclist, hash);
+    word_count_t *wc = NULL;
+    LOCK(wclist, shard);
+    if (shard->table.cap != 0) {
+        wc = *table_probe(&shard->table, word, strlen(word), hash);
+    }
+    UNLOCK(wclist, shard);
+    return wc;
+}
+
+/*
+ * Adds count to word's entry, creating the entry if needed. A new entry is
+ * allocated from the shard's arena together with a copy of the len bytes of
+ * word and its NUL. If owned, word is freed on success; on failure the
+ * caller keeps it, as add_word promises.
+ */
+static word_count_t *shard_add(word_count_list_t *wclist, char *word,
+                               size_t len, int count, bool owned) {
+    uint64_t hash = word_hash(word);
+    struct word_shard *shard = shard_of(wclist, hash);
+    struct word_table *table = &shard->table;
+    word_count_t **slot;
+    word_count_t *wc = NULL;
+
+    LOCK(wclist, shard);
+    /* Keep the load factor at or below 3/4 so probe sequences stay short. */
+    if (4 * (table->len + 1) > 3 * table->cap && !table_grow(table)) {
+        goto done;
+    }
+    slot = table_probe(table, word, len, hash);
+    if ((wc = *slot) != NULL) {
+        wc->count += count;
+    } else if ((wc = arena_alloc(&shard->arena, sizeof(word_count_t) + len + 1)) != NULL) {
+        wc->word = memcpy((char *) (wc + 1), word, len + 1);
+        wc->count = count;
+        wc->hash = hash;
+        wc->len = len;
+        *slot = wc;
+        table->len++;
+    }
+done:
+    UNLOCK(wclist, shard);
+    if (owned && wc != NULL) {
+        free(word);
+    }
+    return wc;
+}
+
+word_count_t *add_word_with_count(word_count_list_t *wclist, char *word, int count) {
+    return shard_add(wclist, word, strlen(word), count, true);
+}
+
+word_count_t *add_word(word_count_list_t *wclist, char *word) {
+    return shard_add(wclist, word, strlen(word), 1, true);
+}
+
+word_count_t *add_word_copy(word_count_list_t *wclist, const char *word,
+                            size_t len) {
+    return shard_add(wclist, (char *) word, len, 1, false);
+}
+
+word_count_t *add_word_copy_with_count(word_count_list_t *wclist,
+                                       const char *word, size_t len, int count) {
+    return shard_add(wclist, (char *) word, len, count, false);
+}
+
+/* Empties every shard, releasing its slots and arena. */
+static void clear_shards(word_count_list_t *wclist) {
+    for (int i = 0; i < WORD_SHARDS; i++) {
+        struct word_shard *shard = &wclist->shards[i];
+        free(shard->table.slots);
+        shard->table.slots = NULL;
+        shard->table.cap = 0;
+        shard->table.len = 0;
+        arena_free(&shard->arena);
+    }
+    free(wclist->sorted);
+    wclist->sorted = NULL;
+    wclist->sorted_len = 0;
+}
+
+void merge_words(word_count_list_t *dst, word_count_list_t *src) {
+    lock_all(src);
+    for (int i = 0; i < WORD_SHARDS; i++) {
+        struct word_table *table = &src->shards[i].table;
+        for (size_t j = 0; j < table->cap; j++) {
+            word_count_t *wc = table->slots[j];
+            if (wc != NULL) {
+                shard_add(dst, wc->word, wc->len, wc->count, false);
+            }
+        }
+    }
+    clear_shards(src);
+    unlock_all(src);
+}
+
+void free_words(word_count_list_t *wclist) {
+    lock_all(wclist);
+    clear_shards(wclist);
+    unlock_all(wclist);
+}
+
+void foreach_word(word_count_list_t *wclist,
+                  void fn(word_count_t *wc, void *aux), void *aux) {
+    lock_all(wclist);
+    if (wclist->sorted != NULL && wclist->sorted_len == total_len(wclist)) {
+        for (size_t i = 0; i < wclist->sorted_len; i++) {
+            fn(wclist->sorted[i], aux);
+        }
+    } else {
+        for (int i = 0; i < WORD_SHARDS; i++) {
+            struct word_table *table = &wclist->shards[i].table;
+            for (size_t j = 0; j < table->cap; j++) {
+                if (table->slots[j] != NULL) {
+                    fn(table->slots[j], aux);
+                }
+            }
+        }
+    }
+    unlock_all(wclist);
+}
+
+static void fprint_word(word_count_t *wc, void *em) {
+    emit_word(em, wc->count, wc->word);
+}
+
+void fprint_words(word_count_list_t *wclist, FILE *outfile) {
+    struct word_emitter em;
+    emit_init(&em, outfile);
+    foreach_word(wclist, fprint_word, &em);
+    emit_finish(&em);
+}
+
+void wordcount_sort(word_count_list_t *wclist,
+                    bool less(const word_count_t *, const word_count_t *)) {
+    word_count_t **sorted;
+    word_count_t **tmp;
+
+    lock_all(wclist);
+    size_t len = total_len(wclist);
+    if (len == 0) {
+        free(wclist->sorted);
+        wclist->sorted = NULL;
+        wclist->sorted_len = 0;
+        unlock_all(wclist);
+        return;
+    }
+    sorted = malloc(len * sizeof(word_count_t *));
+    tmp = malloc(len * sizeof(word_count_t *));
+    if (sorted == NULL || tmp == NULL) {
+        perror("malloc");
+        free(sorted);
+        free(tmp);
+        unlock_all(wclist);
+        return;
+    }
+    size_t n = 0;
+    for (int i = 0; i < WORD_SHARDS; i++) {
+        struct word_table *table = &wclist->shards[i].table;
+        for (size_t j = 0; j < table->cap; j++) {
+            if (table->slots[j] != NULL) {
+                sorted[n++] = table->slots[j];
+            }
+        }
+    }
+    merge_sort(sorted, tmp, n, less);
+    free(tmp);
+    free(wclist->sorted);
+    wclist->sorted = sorted;
+    wclist->sorted_len = n;
+    unlock_all(wclist);
+}
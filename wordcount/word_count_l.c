@@ -21,6 +21,8 @@
  */
 
 #include "word_count.h"
+#include "word_emit.h"
+#include "word_sort.h"
 
 void init_words(word_count_list_t *wclist) {
     list_init(wclist);
@@ -32,46 +34,108 @@ size_t len_words(word_count_list_t *wclist) {
 
 word_count_t *find_word(word_count_list_t *wclist, char *word) {
     struct list_elem *e; // iterator for list elements
+    uint32_t hash = word_hash(word);
 
     for(e = list_begin(wclist); e != list_end(wclist); e = list_next(e)) {
         struct word_count *wc = list_entry(e, struct word_count, elem);
-        if (strcmp(wc->word, word) == 0) {
+        // the hash rules out almost every other word without reading it
+        if (wc->hash == hash && strcmp(wc->word, word) == 0) {
             return wc;
         }
     }
     return NULL;
 }
 
+// create a word_count for a word known to be absent and put it at the front
+static word_count_t *push_word(word_count_list_t *wclist, char *word, int count) {
+    word_count_t *wc = malloc(sizeof(word_count_t));
+    if (wc) {
+        wc->word = word;
+        wc->count = count;
+        wc->hash = word_hash(word);
+        list_push_front(wclist, &wc->elem);
+    } else {
+        perror("malloc");
+    }
+    return wc;
+}
+
 word_count_t *add_word_with_count(word_count_list_t *wclist, char *word, int count) {
     word_count_t *wc = find_word(wclist, word);
     if (wc != NULL) {
         // word exists, increment count
         wc->count += count;
-    } else {
-        // create new word_count structure
-        wc = malloc(sizeof(word_count_t));
-        if (wc) {
-            wc->word = word;
-            wc->count = count;
-            list_push_front(wclist, &wc->elem);
-        } else {
-            perror("malloc");
-        }
+        return wc;
     }
-    return wc;
+    return push_word(wclist, word, count);
 }
 
 word_count_t *add_word(word_count_list_t *wclist, char *word) {
     return add_word_with_count(wclist, word, 1);
 }
 
+word_count_t *add_word_copy_with_count(word_count_list_t *wclist, const char *word,
+                                       size_t len, int count) {
+    word_count_t *wc = find_word(wclist, (char *) word);
+    if (wc != NULL) {
+        wc->count += count;
+        return wc;
+    }
+    // first sighting, so the list needs its own copy of the word
+    char *copy = malloc(len + 1);
+    if (copy == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    memcpy(copy, word, len + 1);
+    if ((wc = push_word(wclist, copy, count)) == NULL)
+        free(copy);
+    return wc;
+}
+
+word_count_t *add_word_copy(word_count_list_t *wclist, const char *word, size_t len) {
+    return add_word_copy_with_count(wclist, word, len, 1);
+}
+
+void merge_words(word_count_list_t *dst, word_count_list_t *src) {
+    while (!list_empty(src)) {
+        word_count_t *wc = list_entry(list_pop_front(src), word_count_t, elem);
+        word_count_t *merged = add_word_with_count(dst, wc->word, wc->count);
+        // dst already had the word, so it did not keep this copy
+        if (merged == NULL || merged->word != wc->word) {
+            free(wc->word);
+        }
+        free(wc);
+    }
+}
+
+void free_words(word_count_list_t *wclist) {
+    while (!list_empty(wclist)) {
+        word_count_t *wc = list_entry(list_pop_front(wclist), word_count_t, elem);
+        free(wc->word);
+        free(wc);
+    }
+}
+
+void foreach_word(word_count_list_t *wclist,
+                  void fn(word_count_t *wc, void *aux), void *aux) {
+    struct list_elem *e;
+
+    for (e = list_begin(wclist); e != list_end(wclist); e = list_next(e)) {
+        fn(list_entry(e, word_count_t, elem), aux);
+    }
+}
+
 void fprint_words(word_count_list_t *wclist, FILE *outfile) {
+    struct word_emitter em;
     struct list_elem *e;
-    
+
+    emit_init(&em, outfile);
     for (e = list_begin(wclist); e != list_end(wclist); e = list_next(e)) {
         word_count_t *wc = list_entry(e, word_count_t, elem);
-        fprintf(outfile, "%8d\t%s\n", wc->count, wc->word);
+        emit_word(&em, wc->count, wc->word);
     }
+    emit_finish(&em);
 }
 
 static bool less_list(const struct list_elem *ewc1, const struct list_elem *ewc2, void *aux) {
@@ -84,5 +148,7 @@ static bool less_list(const struct list_elem *ewc1, const struct list_elem *ewc2
 
 void wordcount_sort(word_count_list_t *wclist,
                     bool less(const word_count_t *, const word_count_t *)) {
+    if ((less == less_count || less == less_word) && merge_sort_list(wclist, less))
+        return;
     list_sort(wclist, less_list, less);
 }
@@ -29,10 +29,24 @@
 #endif
 
 #include "word_count.h"
+#include "word_emit.h"
+#include "word_sort.h"
+#include "word_stats.h"
+
+/* Smallest lookup table; it doubles whenever it would become half full. */
+#define LOOKUP_MIN 1024
 
 void init_words(word_count_list_t *wclist) {
     list_init(&wclist->lst);
+    wclist->lookup = NULL;
+    wclist->lookup_len = 0;
     pthread_mutex_init(&wclist->lock, NULL);
+    wclist->local = false;
+}
+
+void init_words_local(word_count_list_t *wclist) {
+    init_words(wclist);
+    wclist->local = true;
 }
 
 size_t len_words(word_count_list_t *wclist) {
@@ -40,45 +54,218 @@ size_t len_words(word_count_list_t *wclist) {
     return len;
 }
 
-word_count_t *find_word(word_count_list_t *wclist, char *word) {
-    struct list_elem *e;
-    for (e = list_begin(&wclist->lst); e != list_end(&wclist->lst); e = list_next(e)) {
-        word_count_t *wc = list_entry(e, word_count_t, elem);
-        if (strcmp(wc->word, word) == 0) {
+/*
+ * Lookups go through the list's lookup table rather than the list. A slot
+ * only ever changes from NULL to an entry, and on a shared list only under
+ * its lock, with a release store made once the entry is fully built. A
+ * larger table is likewise filled before it is published. Probing with
+ * acquire loads therefore sees only whole entries, so a word that is
+ * already present is found without the lock and its count bumped with an
+ * atomic add. A lookup in a table that has since been replaced may miss a
+ * newer entry, but a miss is always checked again under the lock. Entries
+ * are not removed while threads are counting.
+ */
+
+/* Returns the entry for word in table lk, which may be NULL, or NULL. */
+static word_count_t *lookup(struct word_lookup *lk, const char *word, uint32_t hash) {
+    if (lk == NULL) {
+        return NULL;
+    }
+    for (size_t i = hash & lk->mask;; i = (i + 1) & lk->mask) {
+        word_count_t *wc = __atomic_load_n(&lk->slots[i], __ATOMIC_ACQUIRE);
+        if (wc == NULL || (wc->hash == hash && strcmp(wc->word, word) == 0)) {
             return wc;
         }
     }
-    return NULL;
 }
 
-word_count_t *add_word_with_count(word_count_list_t *wclist, char *word, int count) {
-    word_count_t *wc = find_word(wclist, word);
-    if (wc != NULL) {
-        wc->count += count;
-    } else if ((wc = malloc(sizeof(word_count_t))) != NULL) {
-        wc->word = word;
-        wc->count = count;
-        list_push_front(&wclist->lst, &wc->elem);
-    } else {
+static struct word_lookup *current_lookup(word_count_list_t *wclist) {
+    return __atomic_load_n(&wclist->lookup, __ATOMIC_ACQUIRE);
+}
+
+/* Puts wc in a free slot of lk, publishing it to concurrent lookups. */
+static void lookup_put(struct word_lookup *lk, word_count_t *wc) {
+    size_t i = wc->hash & lk->mask;
+    while (lk->slots[i] != NULL) {
+        i = (i + 1) & lk->mask;
+    }
+    __atomic_store_n(&lk->slots[i], wc, __ATOMIC_RELEASE);
+}
+
+/*
+ * Makes room in the lookup table for one more entry, replacing it with one
+ * twice the size if it would be over half full. Caller holds the lock.
+ * Returns false if a larger table cannot be allocated.
+ */
+static bool lookup_reserve(word_count_list_t *wclist) {
+    struct word_lookup *old = wclist->lookup;
+    size_t cap = old == NULL ? LOOKUP_MIN : 2 * (old->mask + 1);
+    struct word_lookup *lk;
+
+    if (old != NULL && 2 * (wclist->lookup_len + 1) <= old->mask + 1) {
+        return true;
+    }
+    if ((lk = malloc(sizeof(struct word_lookup))) == NULL ||
+        (lk->slots = calloc(cap, sizeof(word_count_t *))) == NULL) {
+        perror("malloc");
+        free(lk);
+        return false;
+    }
+    lk->mask = cap - 1;
+    lk->retired = old;
+    if (old != NULL) {
+        for (size_t i = 0; i <= old->mask; i++) {
+            if (old->slots[i] != NULL) {
+                lookup_put(lk, old->slots[i]);
+            }
+        }
+    }
+    __atomic_store_n(&wclist->lookup, lk, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* Frees every lookup table of a list, leaving it without one. */
+static void lookup_free(word_count_list_t *wclist) {
+    struct word_lookup *lk = wclist->lookup;
+    while (lk != NULL) {
+        struct word_lookup *retired = lk->retired;
+        free(lk->slots);
+        free(lk);
+        lk = retired;
+    }
+    wclist->lookup = NULL;
+    wclist->lookup_len = 0;
+}
+
+/*
+ * Returns a new entry for word with count and hash: word itself, or a copy of
+ * its len bytes and NUL if copy is set.
+ */
+static word_count_t *new_entry(char *word, size_t len, int count,
+                               uint32_t hash, bool copy) {
+    word_count_t *wc = malloc(sizeof(word_count_t));
+    char *w = copy ? malloc(len + 1) : word;
+    if (wc == NULL || w == NULL) {
         perror("malloc");
+        free(wc);
+        if (copy)
+            free(w);
+        return NULL;
+    }
+    if (copy)
+        memcpy(w, word, len + 1);
+    wc->word = w;
+    wc->count = count;
+    wc->hash = hash;
+    return wc;
+}
+
+/*
+ * Adds a new entry for word, known to be absent, to the list and its lookup
+ * table. Caller holds the lock of a shared list.
+ */
+static word_count_t *insert_entry(word_count_list_t *wclist, char *word,
+                                  size_t len, int count, uint32_t hash, bool copy) {
+    word_count_t *wc;
+    if (!lookup_reserve(wclist) || (wc = new_entry(word, len, count, hash, copy)) == NULL) {
+        return NULL;
+    }
+    list_push_front(&wclist->lst, &wc->elem);
+    lookup_put(wclist->lookup, wc);
+    wclist->lookup_len++;
+    return wc;
+}
+
+word_count_t *find_word(word_count_list_t *wclist, char *word) {
+    return lookup(current_lookup(wclist), word, word_hash(word));
+}
+
+/*
+ * Adds count to word's entry, creating it with new_entry if needed. Only
+ * creating an entry takes the lock of a shared list.
+ */
+static word_count_t *add_entry(word_count_list_t *wclist, char *word,
+                               size_t len, int count, bool copy) {
+    uint32_t hash = word_hash(word);
+    word_count_t *wc = lookup(current_lookup(wclist), word, hash);
+
+    if (wclist->local) {
+        if (wc != NULL) {
+            wc->count += count;
+            return wc;
+        }
+        return insert_entry(wclist, word, len, count, hash, copy);
     }
+    if (wc == NULL) {
+        stats_mutex_lock(&wclist->lock);
+        /* Another thread may have added it, or grown the table, meanwhile. */
+        wc = lookup(wclist->lookup, word, hash);
+        if (wc == NULL) {
+            wc = insert_entry(wclist, word, len, count, hash, copy);
+            pthread_mutex_unlock(&wclist->lock);
+            return wc;
+        }
+        pthread_mutex_unlock(&wclist->lock);
+    }
+    __atomic_fetch_add(&wc->count, count, __ATOMIC_RELAXED);
     return wc;
 }
 
+word_count_t *add_word_with_count(word_count_list_t *wclist, char *word, int count) {
+    return add_entry(wclist, word, strlen(word), count, false);
+}
+
 word_count_t *add_word(word_count_list_t *wclist, char *word) {
-  pthread_mutex_lock(&wclist->lock);
-  word_count_t *wc = add_word_with_count(wclist, word, 1);
-  pthread_mutex_unlock(&wclist->lock);
-  return wc;
+    return add_entry(wclist, word, strlen(word), 1, false);
+}
+
+word_count_t *add_word_copy_with_count(word_count_list_t *wclist, const char *word,
+                                       size_t len, int count) {
+    return add_entry(wclist, (char *) word, len, count, true);
+}
+
+word_count_t *add_word_copy(word_count_list_t *wclist, const char *word, size_t len) {
+    return add_entry(wclist, (char *) word, len, 1, true);
+}
+
+void merge_words(word_count_list_t *dst, word_count_list_t *src) {
+    while (!list_empty(&src->lst)) {
+        word_count_t *wc = list_entry(list_pop_front(&src->lst), word_count_t, elem);
+        word_count_t *merged = add_word_with_count(dst, wc->word, wc->count);
+        if (merged == NULL || merged->word != wc->word) {
+            free(wc->word);
+        }
+        free(wc);
+    }
+    lookup_free(src);
 }
 
+void free_words(word_count_list_t *wclist) {
+    while (!list_empty(&wclist->lst)) {
+        word_count_t *wc = list_entry(list_pop_front(&wclist->lst), word_count_t, elem);
+        free(wc->word);
+        free(wc);
+    }
+    lookup_free(wclist);
+}
+
+void foreach_word(word_count_list_t *wclist,
+                  void fn(word_count_t *wc, void *aux), void *aux) {
+    struct list_elem *e;
+    for (e = list_begin(&wclist->lst); e != list_end(&wclist->lst); e = list_next(e)) {
+        fn(list_entry(e, word_count_t, elem), aux);
+    }
+}
 
 void fprint_words(word_count_list_t *wclist, FILE *outfile) {
+    struct word_emitter em;
     struct list_elem *e;
+    emit_init(&em, outfile);
     for (e = list_begin(&wclist->lst); e != list_end(&wclist->lst); e = list_next(e)) {
-    word_count_t *wc = list_entry(e, word_count_t, elem);
-    fprintf(outfile, "%8d\t%s\n", wc->count, wc->word);
+        word_count_t *wc = list_entry(e, word_count_t, elem);
+        emit_word(&em, wc->count, wc->word);
     }
+    emit_finish(&em);
 }
 
 static bool less_list(const struct list_elem *ewc1, const struct list_elem *ewc2, void *aux) {
@@ -90,6 +277,8 @@ static bool less_list(const struct list_elem *ewc1, const struct list_elem *ewc2
 }
 
 void wordcount_sort(word_count_list_t *wclist, bool less(const word_count_t *, const word_count_t *)) {
+    if ((less == less_count || less == less_word) && merge_sort_list(&wclist->lst, less))
+        return;
     // runs a merge sort and for every comparison calls less_list with comparator
     list_sort(&wclist->lst, less_list, less);
 }
\ No newline at end of file
@@ -0,0 +1,95 @@
+/*
+ * Implementation of the word_emit interface. The buffer goes out in one
+ * fwrite, which stdio passes straight to write(2) once it is larger than
+ * the stream's own buffer, after writing whatever the stream held before.
+ */
+
+/*
+ * Copyright (C) 2019 University of California, Berkeley
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "word_emit.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Widest record prefix: "%8d" of INT_MIN is 11 characters, then a tab. */
+#define COUNT_MAX_LEN 12
+
+void emit_init(struct word_emitter *em, FILE *outfile) {
+    em->outfile = outfile;
+    em->buf = malloc(EMIT_BUF_SIZE);
+    em->len = 0;
+}
+
+static void emit_flush(struct word_emitter *em) {
+    fwrite(em->buf, 1, em->len, em->outfile);
+    em->len = 0;
+}
+
+/* Formats count as "%8d" does, followed by a tab, at out. Returns the length. */
+static size_t format_count(char *out, int count) {
+    char digits[COUNT_MAX_LEN];
+    unsigned int n = count < 0 ? 0u - (unsigned int) count : (unsigned int) count;
+    size_t i = sizeof(digits);
+    size_t len = 0;
+
+    do {
+        digits[--i] = '0' + n % 10;
+        n /= 10;
+    } while (n != 0);
+    if (count < 0) {
+        digits[--i] = '-';
+    }
+    for (size_t width = sizeof(digits) - i; width < 8; width++) {
+        out[len++] = ' ';
+    }
+    memcpy(out + len, digits + i, sizeof(digits) - i);
+    len += sizeof(digits) - i;
+    out[len++] = '\t';
+    return len;
+}
+
+void emit_word(struct word_emitter *em, int count, const char *word) {
+    size_t word_len = strlen(word);
+
+    if (em->buf == NULL) {
+        fprintf(em->outfile, "%8d\t%s\n", count, word);
+        return;
+    }
+    if (em->len + COUNT_MAX_LEN + word_len + 1 > EMIT_BUF_SIZE) {
+        emit_flush(em);
+        if (COUNT_MAX_LEN + word_len + 1 > EMIT_BUF_SIZE) {
+            /* Longer than the whole buffer: write it out on its own. */
+            char prefix[COUNT_MAX_LEN];
+            fwrite(prefix, 1, format_count(prefix, count), em->outfile);
+            fwrite(word, 1, word_len, em->outfile);
+            fputc('\n', em->outfile);
+            return;
+        }
+    }
+    em->len += format_count(em->buf + em->len, count);
+    memcpy(em->buf + em->len, word, word_len);
+    em->len += word_len;
+    em->buf[em->len++] = '\n';
+}
+
+void emit_finish(struct word_emitter *em) {
+    if (em->buf != NULL) {
+        emit_flush(em);
+        free(em->buf);
+        em->buf = NULL;
+    }
+}
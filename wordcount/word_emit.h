@@ -0,0 +1,49 @@
+/*
+ * The word_emit interface prints word counts in the "%8d\t%s\n" format of
+ * fprint_words without going through printf for every entry. Records are
+ * formatted into a large buffer, which is handed to the stream whole, so
+ * printing a large list takes a few writes rather than one printf call and
+ * its format parsing per word.
+ */
+
+/*
+ * Copyright (C) 2019 University of California, Berkeley
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WORD_EMIT_H
+#define WORD_EMIT_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* Bytes formatted before they are written out. */
+#define EMIT_BUF_SIZE (1 << 20)
+
+struct word_emitter {
+    FILE *outfile;
+    char *buf; /* NULL if it could not be allocated; records use fprintf. */
+    size_t len;
+};
+
+/* Starts an emitter that writes to outfile. */
+void emit_init(struct word_emitter *em, FILE *outfile);
+
+/* Adds a record for word with count, exactly as fprint_words prints it. */
+void emit_word(struct word_emitter *em, int count, const char *word);
+
+/* Writes out everything added and frees the buffer. */
+void emit_finish(struct word_emitter *em);
+
+#endif /* WORD_EMIT_H */
@@ -25,27 +25,163 @@
 #include "word_helpers.h"
 
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "word_count.h"
+#include "word_emit.h"
+#include "word_scan.h"
+#include "word_sort.h"
+#include "word_stats.h"
+#include "word_utf8.h"
+
+/* Bytes per read-ahead buffer, and how many are filled ahead of counting. */
+#ifndef READAHEAD_SIZE
+#define READAHEAD_SIZE (1 << 20)
+#endif
+#define READAHEAD_BUFS 3
+
+/* Files are only split if each thread gets at least this many bytes. */
+#define MIN_CHUNK_SIZE (1 << 20)
+
+static enum word_encoding encoding = WORDS_ASCII;
+
+void set_word_encoding(enum word_encoding enc) {
+    encoding = enc;
+}
+
+enum word_encoding get_word_encoding(void) {
+    return encoding;
+}
+
+/*
+ * Returns true if byte c can be part of a word: an ASCII letter, or with a
+ * UTF-8 encoding, any byte of a multi-byte sequence. Whether such a sequence
+ * is really a letter is left to count_utf8_run.
+ */
+static inline bool is_word_byte(int c) {
+    return isalpha(c) || (encoding != WORDS_ASCII && c >= 0x80);
+}
+
+/* add_word_copy, timed and counted when instrumentation is on. */
+static inline word_count_t *insert_copy(word_count_list_t *wclist,
+                                        const char *word, size_t len) {
+    if (!stats_enabled) {
+        return add_word_copy(wclist, word, len);
+    }
+    STATS_BEGIN(t);
+    word_count_t *wc = add_word_copy(wclist, word, len);
+    STATS_END(STAT_INSERT, t);
+    stats_add(STAT_WORDS, 1);
+    return wc;
+}
+
+/* add_word, timed and counted when instrumentation is on. */
+static inline word_count_t *insert_word(word_count_list_t *wclist, char *word) {
+    if (!stats_enabled) {
+        return add_word(wclist, word);
+    }
+    STATS_BEGIN(t);
+    word_count_t *wc = add_word(wclist, word);
+    STATS_END(STAT_INSERT, t);
+    stats_add(STAT_WORDS, 1);
+    return wc;
+}
+
+/* Returns true if any of the len bytes at s is outside ASCII. */
+static inline bool has_high_bytes(const char *s, size_t len) {
+    unsigned char high = 0;
+    for (size_t i = 0; i < len; i++) {
+        high |= s[i];
+    }
+    return high & 0x80;
+}
+
+/*
+ * Counts the words in a run of len word bytes holding UTF-8. Letters are
+ * decoded and, with WORDS_UTF8_FOLD, case folded; anything else (invalid
+ * sequences, punctuation such as curly quotes) ends a word. As with ASCII,
+ * ASCII letters are lowercased and one-letter words are not counted; marks
+ * (see utf8_is_mark) are kept but not counted as letters.
+ * Returns false if a word could not be added.
+ */
+static bool count_utf8_run(word_count_list_t *wclist, const char *run,
+                           size_t len) {
+    char small[256];
+    char *word = small;
+    size_t n = 0, letters = 0;
+    bool ok = true;
+
+    /* Folding never lengthens a letter, so words fit in len bytes. */
+    if (len + 1 > sizeof(small) && (word = malloc(len + 1)) == NULL) {
+        perror("malloc");
+        return false;
+    }
+    for (size_t i = 0; i <= len;) {
+        uint32_t cp = 0;
+        size_t k = i < len ? utf8_decode(run + i, len - i, &cp) : 0;
+        if (k != 0 && utf8_is_letter(cp)) {
+            if (cp < 0x80) {
+                word[n++] = cp | 0x20;
+            } else {
+                if (encoding == WORDS_UTF8_FOLD) {
+                    cp = utf8_fold(cp);
+                }
+                n += utf8_encode(cp, word + n);
+            }
+            letters += !utf8_is_mark(cp);
+            i += k;
+            continue;
+        }
+        /* A non-letter, a malformed byte or the end of the run. */
+        if (letters > 1) {
+            word[n] = '\0';
+            if (insert_copy(wclist, word, n) == NULL) {
+                ok = false;
+                break;
+            }
+        }
+        n = 0;
+        letters = 0;
+        i += k != 0 ? k : 1;
+    }
+    if (word != small) {
+        free(word);
+    }
+    return ok;
+}
 
 /*
  * Reads a word from a stream, skipping initial non-alpha characters, and
  * stores it in a malloc'd buffer. Returns length of the word, or 0 if reached
- * end of file.
+ * end of file. If limit is not NULL, it holds the number of bytes left in the
+ * range being read; it is decremented for every byte consumed, and 0 is
+ * returned if the next word would start past the end of the range.
  */
-static size_t get_word(char **word, FILE *infile) {
+static size_t get_word(char **word, FILE *infile, off_t *limit) {
     int ch;
     size_t buffer_cap = 16;
     size_t index = 0;
     char *buffer;
 
     /* Skip initial non-alpha characters. */
-    while (!isalpha(ch = fgetc(infile))) {
+    do {
+        ch = fgetc(infile);
         if (ch == EOF) {
             return 0;
         }
-    }
+        if (limit != NULL && (*limit)-- <= 0) {
+            /* Leave the byte for whoever reads on from here. */
+            ungetc(ch, infile);
+            return 0;
+        }
+    } while (!is_word_byte(ch));
 
     /* Allocate buffer on heap. */
     if ((buffer = malloc(buffer_cap * sizeof(char))) == NULL) {
@@ -68,32 +204,738 @@ static size_t get_word(char **word, FILE *infile) {
             }
             buffer = new_buffer;
         }
-    } while (isalpha(ch = fgetc(infile)));
+        if (limit != NULL) {
+            (*limit)--;
+        }
+    } while (is_word_byte(ch = fgetc(infile)));
     buffer[index] = '\0';
 
     *word = buffer;
     return index;
 }
 
-void count_words(word_count_list_t *wclist, FILE *infile) {
-    /* Extract all words in infile and update word counts for them. */
+/* Counts the words read by get_word until it returns 0. */
+static void count_stream(word_count_list_t *wclist, FILE *infile,
+                         off_t *limit) {
     char *word;
     size_t len;
-    while ((len = get_word(&word, infile)) != 0) {
+    while ((len = get_word(&word, infile, limit)) != 0) {
         if (len == 1) {
             free(word);
-        } else if (add_word(wclist, word) == NULL) {
+        } else if (encoding != WORDS_ASCII && has_high_bytes(word, len)) {
+            bool ok = count_utf8_run(wclist, word, len);
+            free(word);
+            if (!ok) {
+                return;
+            }
+        } else if (insert_word(wclist, word) == NULL) {
             free(word);
             return;
         }
     }
 }
 
+/*
+ * Cursor over the word-byte mask of a buffer, one 64-byte block at a time, so
+ * the word_scan kernel runs once per block rather than once per word.
+ */
+struct mask_cursor {
+    const char *buf;
+    size_t size;
+    size_t block; /* Offset of the block whose mask is cached. */
+    uint64_t mask;
+    uint64_t (*kernel)(const char *buf); /* alpha_mask64 or utf8_mask64. */
+};
+
+static inline uint64_t block_mask(struct mask_cursor *mc, size_t block) {
+    if (block != mc->block) {
+        mc->block = block;
+        if (block + 64 <= mc->size) {
+            mc->mask = mc->kernel(mc->buf + block);
+        } else {
+            /* The last block is short; bytes past the end are not alpha. */
+            mc->mask = 0;
+            for (size_t k = 0; block + k < mc->size; k++) {
+                if (is_word_byte((unsigned char) mc->buf[block + k])) {
+                    mc->mask |= (uint64_t) 1 << k;
+                }
+            }
+        }
+    }
+    return mc->mask;
+}
+
+/*
+ * Returns the first index in [i, limit) whose byte is alphabetic (or, if not
+ * alpha, non-alphabetic), or limit if there is none. limit must not exceed
+ * the buffer size.
+ */
+static inline size_t scan_to(struct mask_cursor *mc, size_t i, size_t limit,
+                             bool alpha) {
+    if (mc->kernel == NULL) {
+        while (i < limit && !is_word_byte((unsigned char) mc->buf[i]) != !alpha) {
+            i++;
+        }
+        return i;
+    }
+    while (i < limit) {
+        size_t block = i & ~(size_t) 63;
+        uint64_t m = block_mask(mc, block);
+        if (!alpha) {
+            m = ~m;
+        }
+        m &= ~(uint64_t) 0 << (i - block);
+        if (m != 0) {
+            i = block + __builtin_ctzll(m);
+            return i < limit ? i : limit;
+        }
+        i = block + 64;
+    }
+    return limit;
+}
+
+/*
+ * Counts the words that start in buf[start, end) of a buffer holding size
+ * bytes, finishing the last word even if it runs past end. A word straddling
+ * start belongs to whoever counts the bytes before it, and is skipped. Each
+ * word is lowercased into a scratch buffer and handed to add_word_copy, so
+ * only words not yet in the list are allocated.
+ */
+static void count_buffer(word_count_list_t *wclist, const char *buf,
+                         size_t size, size_t start, size_t end) {
+    struct mask_cursor mc = { buf, size, SIZE_MAX, 0,
+                              encoding == WORDS_ASCII ? alpha_mask64 : utf8_mask64 };
+    char small[64];
+    char *scratch = small;
+    size_t scratch_cap = sizeof(small);
+    size_t i = start;
+
+    if (i > 0 && is_word_byte((unsigned char) buf[i - 1])) {
+        i = scan_to(&mc, i, size, false);
+    }
+    for (;;) {
+        /* Skip initial non-alpha characters. */
+        if ((i = scan_to(&mc, i, end, true)) >= end) {
+            break;
+        }
+        size_t first = i;
+        i = scan_to(&mc, i, size, false);
+        size_t len = i - first;
+        if (len == 1) {
+            continue;
+        }
+
+        /* Expand scratch buffer to fit the word and its NUL. */
+        if (len >= scratch_cap) {
+            char *new_scratch;
+            while (len >= scratch_cap) {
+                scratch_cap *= 2;
+            }
+            if ((new_scratch = malloc(scratch_cap)) == NULL) {
+                perror("malloc");
+                break;
+            }
+            if (scratch != small) {
+                free(scratch);
+            }
+            scratch = new_scratch;
+        }
+        /*
+         * ASCII letters are lowercased by setting bit 0x20. Any byte with its
+         * top bit set means the word is UTF-8 and needs decoding instead.
+         */
+        unsigned char high = 0;
+        for (size_t j = 0; j < len; j++) {
+            scratch[j] = buf[first + j] | 0x20;
+            high |= buf[first + j];
+        }
+        if (high & 0x80) {
+            if (!count_utf8_run(wclist, buf + first, len)) {
+                break;
+            }
+            continue;
+        }
+        scratch[len] = '\0';
+        if (insert_copy(wclist, scratch, len) == NULL) {
+            break;
+        }
+    }
+    if (scratch != small) {
+        free(scratch);
+    }
+}
+
+/*
+ * Memory-maps the regular file behind infile and counts the words starting
+ * in bytes [start, end) of it, or [start, EOF) if end is negative. Returns
+ * false without reading anything if the file cannot be mapped, e.g. because
+ * it is a pipe.
+ */
+static bool count_mapped(word_count_list_t *wclist, FILE *infile, off_t start,
+                         off_t end) {
+    struct stat st;
+    char *buf;
+
+    if (fstat(fileno(infile), &st) != 0 || !S_ISREG(st.st_mode) ||
+        st.st_size == 0) {
+        return false;
+    }
+    buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(infile), 0);
+    if (buf == MAP_FAILED) {
+        return false;
+    }
+    if (end < 0 || end > st.st_size) {
+        end = st.st_size;
+    }
+    madvise(buf, st.st_size, MADV_SEQUENTIAL);
+    if (start < end) {
+        count_buffer(wclist, buf, st.st_size, start, end);
+        if (stats_enabled) {
+            stats_add(STAT_BYTES, end - start);
+        }
+    }
+    munmap(buf, st.st_size);
+    return true;
+}
+
+/*
+ * Buffers shared by count_readahead and its reader thread. The reader fills
+ * them in turn, and a buffer is handed back once its words are counted. A
+ * short fill is the last one.
+ */
+struct readahead {
+    FILE *infile;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;
+    pthread_cond_t emptied;
+    char *bufs[READAHEAD_BUFS];
+    size_t lens[READAHEAD_BUFS];
+    bool full[READAHEAD_BUFS];
+};
+
+/* Thread function filling read-ahead buffers until the stream runs out. */
+static void *readahead_fill(void *arg) {
+    struct readahead *ra = arg;
+    for (size_t n = 0;; n++) {
+        int b = n % READAHEAD_BUFS;
+        pthread_mutex_lock(&ra->lock);
+        while (ra->full[b]) {
+            pthread_cond_wait(&ra->emptied, &ra->lock);
+        }
+        pthread_mutex_unlock(&ra->lock);
+
+        size_t len = fread(ra->bufs[b], 1, READAHEAD_SIZE, ra->infile);
+        pthread_mutex_lock(&ra->lock);
+        ra->lens[b] = len;
+        ra->full[b] = true;
+        pthread_cond_signal(&ra->filled);
+        pthread_mutex_unlock(&ra->lock);
+        if (len < READAHEAD_SIZE) {
+            return NULL;
+        }
+    }
+}
+
+/* Appends to a carried word, or drops the word if it will not fit. */
+static bool carry_append(struct word_carry *c, const char *bytes, size_t len) {
+    if (c->len + len > c->cap) {
+        size_t cap = c->cap ? c->cap : 64;
+        while (c->len + len > cap) {
+            cap *= 2;
+        }
+        char *buf = realloc(c->buf, cap);
+        if (buf == NULL) {
+            perror("realloc");
+            c->len = 0;
+            return false;
+        }
+        c->buf = buf;
+        c->cap = cap;
+    }
+    memcpy(c->buf + c->len, bytes, len);
+    c->len += len;
+    return true;
+}
+
+/*
+ * Counts the words in one buffer of a stream. A word begun in an earlier
+ * buffer is completed from the start of this one, and a word still going
+ * at its end is carried over to the next.
+ */
+static void count_read(word_count_list_t *wclist, struct word_carry *c,
+                       const char *buf, size_t len) {
+    size_t first = 0, last = len;
+    if (c->len > 0 || c->dropping) {
+        while (first < len && is_word_byte((unsigned char) buf[first])) {
+            first++;
+        }
+        /* Out of memory drops the carried word, but not the rest of buf. */
+        if (!c->dropping && !carry_append(c, buf, first)) {
+            c->dropping = true;
+        }
+        if (first == len) {
+            /* Still inside the carried word. */
+            return;
+        }
+        if (!c->dropping) {
+            count_buffer(wclist, c->buf, c->len, 0, c->len);
+        }
+        c->len = 0;
+        c->dropping = false;
+    }
+    while (last > first && is_word_byte((unsigned char) buf[last - 1])) {
+        last--;
+    }
+    if (first < last) {
+        count_buffer(wclist, buf + first, last - first, 0, last - first);
+    }
+    c->dropping = !carry_append(c, buf + last, len - last);
+}
+
+/*
+ * Counts the words in a stream that cannot be mapped, with a thread reading
+ * the next buffers while the current one is counted. Returns false, having
+ * read nothing, if the buffers or the thread could not be set up.
+ */
+static bool count_readahead(word_count_list_t *wclist, FILE *infile) {
+    struct readahead ra = { .infile = infile };
+    struct word_carry c = { NULL, 0, 0, false };
+    pthread_t reader;
+    char *bufs = malloc((size_t) READAHEAD_BUFS * READAHEAD_SIZE);
+
+    if (bufs == NULL) {
+        return false;
+    }
+    for (int b = 0; b < READAHEAD_BUFS; b++) {
+        ra.bufs[b] = bufs + (size_t) b * READAHEAD_SIZE;
+    }
+    pthread_mutex_init(&ra.lock, NULL);
+    pthread_cond_init(&ra.filled, NULL);
+    pthread_cond_init(&ra.emptied, NULL);
+    /* Widens the kernel's own read-ahead where the stream is a file. */
+    posix_fadvise(fileno(infile), 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (pthread_create(&reader, NULL, readahead_fill, &ra) != 0) {
+        free(bufs);
+        return false;
+    }
+
+    for (size_t n = 0;; n++) {
+        int b = n % READAHEAD_BUFS;
+        pthread_mutex_lock(&ra.lock);
+        while (!ra.full[b]) {
+            pthread_cond_wait(&ra.filled, &ra.lock);
+        }
+        size_t len = ra.lens[b];
+        pthread_mutex_unlock(&ra.lock);
+
+        count_read(wclist, &c, ra.bufs[b], len);
+        if (stats_enabled) {
+            stats_add(STAT_BYTES, len);
+        }
+
+        pthread_mutex_lock(&ra.lock);
+        ra.full[b] = false;
+        pthread_cond_signal(&ra.emptied);
+        pthread_mutex_unlock(&ra.lock);
+        if (len < READAHEAD_SIZE) {
+            break;
+        }
+    }
+    if (c.len > 0) {
+        count_buffer(wclist, c.buf, c.len, 0, c.len);
+    }
+
+    pthread_join(reader, NULL);
+    pthread_cond_destroy(&ra.emptied);
+    pthread_cond_destroy(&ra.filled);
+    pthread_mutex_destroy(&ra.lock);
+    free(c.buf);
+    free(bufs);
+    return true;
+}
+
+void count_words_fed(word_count_list_t *wclist, struct word_carry *carry,
+                     const char *buf, size_t len) {
+    STATS_BEGIN(t);
+    if (len > 0) {
+        count_read(wclist, carry, buf, len);
+    } else {
+        if (carry->len > 0) {
+            count_buffer(wclist, carry->buf, carry->len, 0, carry->len);
+        }
+        carry->len = 0;
+        carry->dropping = false;
+    }
+    STATS_END(STAT_COUNT, t);
+    if (stats_enabled) {
+        stats_add(STAT_BYTES, len);
+    }
+}
+
+void count_words(word_count_list_t *wclist, FILE *infile) {
+    STATS_BEGIN(t);
+    /* Extract all words in infile and update word counts for them. */
+    off_t pos = ftello(infile);
+    if (pos >= 0 && count_mapped(wclist, infile, pos, -1)) {
+        /* Leave the stream at EOF, as if it had been read. */
+        fseeko(infile, 0, SEEK_END);
+    } else if (!count_readahead(wclist, infile)) {
+        count_stream(wclist, infile, NULL);
+    }
+    STATS_END(STAT_COUNT, t);
+}
+
+bool count_words_some(word_count_list_t *wclist, FILE *infile, size_t limit) {
+    STATS_BEGIN(t);
+    off_t left = limit;
+    count_stream(wclist, infile, &left);
+    STATS_END(STAT_COUNT, t);
+    if (stats_enabled) {
+        stats_add(STAT_BYTES, limit - left);
+    }
+    return !feof(infile) && !ferror(infile);
+}
+
+static void count_range(word_count_list_t *wclist, FILE *infile, off_t start,
+                        off_t end) {
+    off_t limit = end - start;
+
+    if (count_mapped(wclist, infile, start, end)) {
+        return;
+    }
+    if (fseeko(infile, start > 0 ? start - 1 : 0, SEEK_SET) != 0) {
+        perror("fseeko");
+        return;
+    }
+    /*
+     * A word straddling start belongs to the range before this one, so skip
+     * past the rest of it.
+     */
+    if (start > 0 && is_word_byte(fgetc(infile))) {
+        do {
+            limit--;
+        } while (is_word_byte(fgetc(infile)));
+    }
+    count_stream(wclist, infile, &limit);
+}
+
+void count_words_range(word_count_list_t *wclist, FILE *infile, off_t start,
+                       off_t end) {
+    STATS_BEGIN(t);
+    count_range(wclist, infile, start, end);
+    STATS_END(STAT_COUNT, t);
+}
+
+off_t word_boundary(FILE *infile, off_t offset) {
+    int ch;
+    if (fseeko(infile, offset, SEEK_SET) != 0) {
+        perror("fseeko");
+        return offset;
+    }
+    while ((ch = fgetc(infile)) != EOF && is_word_byte(ch)) {
+        offset++;
+    }
+    return offset;
+}
+
+struct chunk_args {
+    const char *path;
+    off_t start;
+    off_t end;
+    word_count_list_t wclist;
+    bool ok; /* Cleared if the file could not be opened. */
+};
+
+/* Thread function counting one range of a file into its own list. */
+static void *count_chunk(void *arg) {
+    struct chunk_args *ca = arg;
+    FILE *infile = fopen(ca->path, "r");
+    if (infile == NULL) {
+        perror(ca->path);
+        ca->ok = false;
+        return NULL;
+    }
+    count_words_range(&ca->wclist, infile, ca->start, ca->end);
+    fclose(infile);
+    return NULL;
+}
+
+bool count_words_parallel(word_count_list_t *wclist, const char *path,
+                          int nthreads) {
+    FILE *infile;
+    struct stat st;
+    struct chunk_args *chunks;
+    pthread_t *threads;
+    bool ok = true;
+    int rc;
+
+    if ((infile = fopen(path, "r")) == NULL) {
+        perror(path);
+        return false;
+    }
+    if (nthreads <= 1 || fstat(fileno(infile), &st) != 0 ||
+        !S_ISREG(st.st_mode) || st.st_size / nthreads < MIN_CHUNK_SIZE) {
+        count_words(wclist, infile);
+        fclose(infile);
+        return true;
+    }
+
+    /* Each chunk's list may hold shards aligned past what calloc promises. */
+    rc = posix_memalign((void **) &chunks, __alignof__(struct chunk_args),
+                        nthreads * sizeof(struct chunk_args));
+    threads = rc == 0 ? calloc(nthreads, sizeof(pthread_t)) : NULL;
+    if (rc != 0 || threads == NULL) {
+        if (rc != 0) {
+            fprintf(stderr, "posix_memalign: %s\n", strerror(rc));
+        } else {
+            perror("calloc");
+            free(chunks);
+        }
+        count_words(wclist, infile);
+        fclose(infile);
+        return true;
+    }
+
+    /* Move each even split point forward past any word it lands in. */
+    off_t start = 0;
+    for (int i = 0; i < nthreads; i++) {
+        off_t end = st.st_size;
+        if (i < nthreads - 1) {
+            end = word_boundary(infile, st.st_size / nthreads * (i + 1));
+            end = end < start ? start : end;
+        }
+        chunks[i].path = path;
+        chunks[i].start = start;
+        chunks[i].end = end;
+        chunks[i].ok = true;
+#ifdef PTHREADS
+        init_words_local(&chunks[i].wclist);
+#else
+        init_words(&chunks[i].wclist);
+#endif /* PTHREADS */
+        start = end;
+    }
+    fclose(infile);
+
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&threads[i], NULL, count_chunk, &chunks[i]) != 0) {
+            perror("pthread_create");
+            /* Count it here instead; pthread_self() marks it as joined. */
+            count_chunk(&chunks[i]);
+            threads[i] = pthread_self();
+        }
+    }
+    for (int i = 0; i < nthreads; i++) {
+        if (!pthread_equal(threads[i], pthread_self())) {
+            pthread_join(threads[i], NULL);
+        }
+        merge_words(wclist, &chunks[i].wclist);
+        ok = ok && chunks[i].ok;
+    }
+    free(chunks);
+    free(threads);
+    return ok;
+}
+
+/* foreach_word callback: add wc's count to a sketch. */
+static void sketch_word(word_count_t *wc, void *sk) {
+    sketch_add(sk, wc->word, wc->count);
+}
+
+void sketch_words(struct word_sketch *sk, word_count_list_t *wclist) {
+    foreach_word(wclist, sketch_word, sk);
+}
+
+/* Initializes a list for one batch, unlocked if lists are locked. */
+static void init_batch(word_count_list_t *wclist) {
+#ifdef PTHREADS
+    init_words_local(wclist);
+#else
+    init_words(wclist);
+#endif /* PTHREADS */
+}
+
+void count_words_batched(word_count_list_t *wclist, FILE *infile, size_t batch,
+                         void fn(word_count_list_t *, void *), void *aux) {
+    struct stat st;
+    off_t pos = ftello(infile);
+    bool more;
+
+    if (pos >= 0 && fstat(fileno(infile), &st) == 0 && S_ISREG(st.st_mode)) {
+        /* Batches are ranges of the file, cut where no word is split. */
+        for (off_t start = pos, end; start < st.st_size; start = end) {
+            end = st.st_size;
+            if ((size_t) (st.st_size - start) > batch) {
+                end = word_boundary(infile, start + batch);
+            }
+            count_words_range(wclist, infile, start, end);
+            fn(wclist, aux);
+        }
+        fseeko(infile, 0, SEEK_END);
+        return;
+    }
+    do {
+        more = count_words_some(wclist, infile, batch);
+        fn(wclist, aux);
+    } while (more);
+}
+
+/* count_words_batched callback: move a batch's counts into a sketch. */
+static void sketch_batch(word_count_list_t *wclist, void *sk) {
+    sketch_words(sk, wclist);
+    free_words(wclist);
+    init_batch(wclist);
+}
+
+void count_words_sketch(struct word_sketch *sk, FILE *infile) {
+    word_count_list_t batch;
+    init_batch(&batch);
+    count_words_batched(&batch, infile, SKETCH_BATCH, sketch_batch, sk);
+    free_words(&batch);
+}
+
+void fwrite_record(FILE *outfile, uint32_t count, const char *word, size_t len) {
+    struct count_record rec = { count, len };
+    fwrite(&rec, sizeof(rec), 1, outfile);
+    fwrite(word, 1, len + 1, outfile);
+}
+
+/* foreach_word callback: append wc to the stream as a count record. */
+static void write_record(word_count_t *wc, void *outfile) {
+    fwrite_record(outfile, wc->count, wc->word, strlen(wc->word));
+}
+
+void fwrite_records(word_count_list_t *wclist, FILE *outfile) {
+    foreach_word(wclist, write_record, outfile);
+}
+
+size_t merge_records(word_count_list_t *wclist, const char *buf, size_t len) {
+    const char *p = buf;
+    const char *end = buf + len;
+    struct count_record rec;
+    while ((size_t) (end - p) >= sizeof(rec)) {
+        memcpy(&rec, p, sizeof(rec));
+        if ((size_t) (end - p) - sizeof(rec) <= rec.len) {
+            break;
+        }
+        const char *word = p + sizeof(rec);
+        if (word[rec.len] != '\0' || memchr(word, '\0', rec.len) != NULL) {
+            fprintf(stderr, "read ill-formed count\n");
+        } else if (add_word_copy_with_count(wclist, word, rec.len, rec.count) == NULL) {
+            perror("could not merge count");
+        }
+        p = word + rec.len + 1;
+    }
+    return p - buf;
+}
+
 bool less_count(const word_count_t *wc1, const word_count_t *wc2) {
-    return (wc1->count < wc2->count) ||
-           ((wc1->count == wc2->count) && (strcmp(wc1->word, wc2->word) < 0));
+    return sort_less_count(wc1, wc2);
 }
 
 bool less_word(const word_count_t *wc1, const word_count_t *wc2) {
-    return strcmp(wc1->word, wc2->word) < 0;
+    return sort_less_word(wc1, wc2);
+}
+
+/*
+ * Bounded min-heap holding the k greatest entries seen so far under less,
+ * with the least of them at heap[0].
+ */
+struct top_heap {
+    word_count_t **heap;
+    size_t len;
+    size_t k;
+    bool (*less)(const word_count_t *, const word_count_t *);
+};
+
+static void heap_sift_down(struct top_heap *th, size_t i) {
+    for (;;) {
+        size_t min = i, l = 2 * i + 1, r = 2 * i + 2;
+        if (l < th->len && th->less(th->heap[l], th->heap[min])) {
+            min = l;
+        }
+        if (r < th->len && th->less(th->heap[r], th->heap[min])) {
+            min = r;
+        }
+        if (min == i) {
+            return;
+        }
+        word_count_t *tmp = th->heap[i];
+        th->heap[i] = th->heap[min];
+        th->heap[min] = tmp;
+        i = min;
+    }
+}
+
+/* foreach_word callback offering one entry to the heap. */
+static void heap_offer(word_count_t *wc, void *aux) {
+    struct top_heap *th = aux;
+    if (th->len < th->k) {
+        size_t i = th->len++;
+        while (i > 0 && th->less(wc, th->heap[(i - 1) / 2])) {
+            th->heap[i] = th->heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        th->heap[i] = wc;
+    } else if (th->less(th->heap[0], wc)) {
+        th->heap[0] = wc;
+        heap_sift_down(th, 0);
+    }
+}
+
+void fprint_top_words(word_count_list_t *wclist, size_t k,
+                      bool less(const word_count_t *, const word_count_t *),
+                      FILE *outfile) {
+    struct top_heap th = { NULL, 0, 0, less };
+    struct word_emitter em;
+    size_t len = len_words(wclist);
+    /* Asking for more entries than there are prints them all. */
+    th.k = k = k < len ? k : len;
+    if (k == 0) {
+        return;
+    }
+    if ((th.heap = malloc(k * sizeof(word_count_t *))) == NULL) {
+        perror("malloc");
+        return;
+    }
+    STATS_BEGIN(t);
+    foreach_word(wclist, heap_offer, &th);
+    emit_init(&em, outfile);
+
+    /* Popping the minimum each time yields the entries in ascending order. */
+    while (th.len > 0) {
+        word_count_t *wc = th.heap[0];
+        th.heap[0] = th.heap[--th.len];
+        heap_sift_down(&th, 0);
+        emit_word(&em, wc->count, wc->word);
+    }
+    emit_finish(&em);
+    free(th.heap);
+    STATS_END(STAT_PRINT, t);
+}
+
+bool parse_long_arg(const char *arg, long min, long *n) {
+    char *end;
+    long value;
+
+    errno = 0;
+    value = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || errno != 0 || value < min) {
+        return false;
+    }
+    *n = value;
+    return true;
+}
+
+bool parse_positive_arg(const char *arg, double *x) {
+    char *end;
+    double value;
+
+    errno = 0;
+    value = strtod(arg, &end);
+    if (end == arg || *end != '\0' || errno != 0 || !(value > 0) || isinf(value)) {
+        return false;
+    }
+    *x = value;
+    return true;
 }
@@ -26,9 +26,27 @@
 #define WORD_HELPERS_H
 
 #include <ctype.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <sys/types.h>
 
 #include "word_count.h"
+#include "word_sketch.h"
+
+/* How the counting functions below split text into words. */
+enum word_encoding {
+    WORDS_ASCII,     /* Runs of ASCII letters, lowercased. The default. */
+    WORDS_UTF8,      /* Runs of UTF-8 letters in any script; ASCII lowercased. */
+    WORDS_UTF8_FOLD, /* As WORDS_UTF8, with every letter case folded. */
+};
+
+/*
+ * Selects how words are recognised. Must be called before any counting
+ * starts, as every thread reads it unsynchronised.
+ */
+void set_word_encoding(enum word_encoding enc);
+
+enum word_encoding get_word_encoding(void);
 
 /*
  * Reads all words from a stream and updates a word count list with their
@@ -36,6 +54,108 @@
  */
 void count_words(word_count_list_t *wclist, FILE *infile);
 
+/*
+ * Reads words from a stream until the next one would start more than limit
+ * bytes from where reading began, and updates a word count list with their
+ * counts. A word under way when the limit is reached is read to its end.
+ * Returns false once the stream has run out, so that calling it until then
+ * gives the same counts as count_words.
+ */
+bool count_words_some(word_count_list_t *wclist, FILE *infile, size_t limit);
+
+/*
+ * The start of a word cut off by the end of a buffer, to be completed from
+ * the next. Starts out as { NULL, 0, 0, false }.
+ */
+struct word_carry {
+    char *buf;
+    size_t len;
+    size_t cap;
+    bool dropping; /* Skipping the rest of a word that did not fit. */
+};
+
+/*
+ * Counts the words in the next len bytes of a stream read a buffer at a
+ * time, such as from a pipe, into a word count list. A word still going at
+ * the end of buf is held in carry until a later call completes it; a call
+ * with len 0 marks the end of the stream and counts it. Free carry->buf
+ * afterwards.
+ */
+void count_words_fed(word_count_list_t *wclist, struct word_carry *carry,
+                     const char *buf, size_t len);
+
+/*
+ * Counts the words that start at byte offsets [start, end) of a seekable
+ * stream. A word that begins in the range is read to its end even if that
+ * lies past end, so counting adjacent ranges gives the same counts as
+ * count_words over the whole stream.
+ */
+void count_words_range(word_count_list_t *wclist, FILE *infile, off_t start,
+                       off_t end);
+
+/*
+ * Returns the first offset at or after offset in a seekable stream that does
+ * not fall inside a word, so a range split there cuts no word in two.
+ */
+off_t word_boundary(FILE *infile, off_t offset);
+
+/*
+ * Counts the words in the file at path by splitting it at word boundaries
+ * into up to nthreads ranges and counting them concurrently. Gives the same
+ * counts as count_words; small or non-seekable files are read serially.
+ * Returns false if the file could not be opened.
+ */
+bool count_words_parallel(word_count_list_t *wclist, const char *path,
+                          int nthreads);
+
+/*
+ * Reads all words from a stream into a word count list a batch of about
+ * batch bytes at a time, calling fn with the list and aux after each batch.
+ * fn may empty the list, so that memory depends on the batch rather than on
+ * the whole stream.
+ */
+void count_words_batched(word_count_list_t *wclist, FILE *infile, size_t batch,
+                         void fn(word_count_list_t *, void *), void *aux);
+
+/* Adds every entry of a word count list to a sketch. */
+void sketch_words(struct word_sketch *sk, word_count_list_t *wclist);
+
+/* Bytes counted exactly before they are added to a sketch. */
+#define SKETCH_BATCH (16 << 20)
+
+/*
+ * Reads all words from a stream into a sketch. Words are counted exactly,
+ * about SKETCH_BATCH bytes of input at a time, and each batch of counts is added to the
+ * sketch and freed, so memory stays bounded however large the input.
+ */
+void count_words_sketch(struct word_sketch *sk, FILE *infile);
+
+/*
+ * Binary form of a word count list, used to pass counts between processes and
+ * to store them on disk: a stream of these headers, each followed by the len
+ * bytes of the word and a NUL. The NUL lets a reader hand words straight
+ * from the stream to add_word_copy_with_count. Fields are in native byte
+ * order.
+ */
+struct count_record {
+    uint32_t count;
+    uint32_t len;
+};
+
+/* Writes one count record for word[0..len), which must be NUL-terminated. */
+void fwrite_record(FILE *outfile, uint32_t count, const char *word, size_t len);
+
+/* Writes every entry of a word count list to a stream as count records. */
+void fwrite_records(word_count_list_t *wclist, FILE *outfile);
+
+/*
+ * Adds the counts in the complete records at the start of buf[0..len) to a
+ * word count list and returns how many bytes they took up. A trailing partial
+ * record is left for the caller to complete and pass again. Words are copied
+ * out of buf only when they are new to the list.
+ */
+size_t merge_records(word_count_list_t *wclist, const char *buf, size_t len);
+
 /*
  * Returns true if the first entry has a lower count than the second entry,
  * breaking ties according to alphabetical order.
@@ -48,4 +168,27 @@ bool less_count(const word_count_t *wc1, const word_count_t *wc2);
  */
 bool less_word(const word_count_t *wc1, const word_count_t *wc2);
 
+/*
+ * Prints the k entries that sort last under less, in the order and format
+ * that wordcount_sort followed by fprint_words would print them. Makes one
+ * pass over the list and keeps only k entries, so it does not sort the rest.
+ * A k larger than the list prints every entry.
+ */
+void fprint_top_words(word_count_list_t *wclist, size_t k,
+                      bool less(const word_count_t *, const word_count_t *),
+                      FILE *outfile);
+
+/*
+ * Parses a command-line argument that must be a whole decimal number of at
+ * least min, storing it in *n. Returns false, leaving *n alone, otherwise.
+ */
+bool parse_long_arg(const char *arg, long min, long *n);
+
+/*
+ * Parses a command-line argument that must be a finite decimal number
+ * greater than 0, storing it in *x. Returns false, leaving *x alone,
+ * otherwise.
+ */
+bool parse_positive_arg(const char *arg, double *x);
+
 #endif /* WORD_HELPERS_H */
@@ -0,0 +1,254 @@
+/*
+ * Implementation of the word_index interface. The previous index is mapped
+ * read-only while the new one is written next to it, so the counts of an
+ * unchanged file go straight from the old mapping into both the list and
+ * the new index.
+ */
+
+/*
+ * Copyright (C) 2019 University of California, Berkeley
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "word_index.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "word_helpers.h"
+
+/* A previous index, mapped read-only. Empty if there was none to use. */
+struct mapped_index {
+    char *map;
+    size_t size;
+    const struct index_file *files;
+    size_t nfiles;
+};
+
+/* Maps the index at path, leaving mi empty if it is missing or damaged. */
+static void map_index(struct mapped_index *mi, const char *path) {
+    struct index_header hdr;
+    struct stat st;
+    int fd;
+
+    mi->map = NULL;
+    mi->size = 0;
+    mi->files = NULL;
+    mi->nfiles = 0;
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        return;
+    }
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(hdr)) {
+        close(fd);
+        return;
+    }
+    mi->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mi->map == MAP_FAILED) {
+        perror("mmap");
+        mi->map = NULL;
+        return;
+    }
+    mi->size = st.st_size;
+
+    memcpy(&hdr, mi->map, sizeof(hdr));
+    if (memcmp(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic)) == 0 &&
+        hdr.encoding != get_word_encoding()) {
+        /* Counted with other word rules, so none of it can be reused. */
+        munmap(mi->map, mi->size);
+        mi->map = NULL;
+        mi->size = 0;
+        return;
+    }
+    if (memcmp(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.table_off % sizeof(uint64_t) != 0 || hdr.table_off > mi->size ||
+        hdr.nfiles > (mi->size - hdr.table_off) / sizeof(struct index_file)) {
+        fprintf(stderr, "%s: ignoring damaged index\n", path);
+        munmap(mi->map, mi->size);
+        mi->map = NULL;
+        mi->size = 0;
+        return;
+    }
+    mi->files = (const struct index_file *) (mi->map + hdr.table_off);
+    mi->nfiles = hdr.nfiles;
+}
+
+/* Returns true if e's path and counts lie within the mapping. */
+static bool entry_in_bounds(struct mapped_index *mi, const struct index_file *e) {
+    return e->path_off < mi->size &&
+           memchr(mi->map + e->path_off, '\0', mi->size - e->path_off) != NULL &&
+           e->words_off <= mi->size && e->words_len <= mi->size - e->words_off;
+}
+
+/*
+ * Returns the entry for path, or NULL. Entry hint is tried first, since files
+ * are usually named in the same order as on the last run.
+ */
+static const struct index_file *find_entry(struct mapped_index *mi,
+                                           const char *path, size_t hint) {
+    for (size_t i = 0; i < mi->nfiles; i++) {
+        const struct index_file *e = &mi->files[(hint + i) % mi->nfiles];
+        if (entry_in_bounds(mi, e) && strcmp(mi->map + e->path_off, path) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/* Returns true if buf[0..len) holds only whole, well-formed count records. */
+static bool records_valid(const char *buf, size_t len) {
+    const char *p = buf;
+    const char *end = buf + len;
+    struct count_record rec;
+    while (p != end) {
+        if ((size_t) (end - p) < sizeof(rec)) {
+            return false;
+        }
+        memcpy(&rec, p, sizeof(rec));
+        if ((size_t) (end - p) - sizeof(rec) <= rec.len) {
+            return false;
+        }
+        const char *word = p + sizeof(rec);
+        if (word[rec.len] != '\0' || memchr(word, '\0', rec.len) != NULL) {
+            return false;
+        }
+        p = word + rec.len + 1;
+    }
+    return true;
+}
+
+/* Counts the file open as infile into an empty list. */
+static bool count_file(word_count_list_t *counts, FILE *infile,
+                       const char *path, int nthreads) {
+    if (nthreads > 1) {
+        return count_words_parallel(counts, path, nthreads);
+    }
+    count_words(counts, infile);
+    return true;
+}
+
+bool count_words_indexed(word_count_list_t *wclist, char **files, int nfiles,
+                         const char *index_path, int nthreads) {
+    struct index_header hdr = { INDEX_MAGIC, get_word_encoding(), 0, 0 };
+    struct mapped_index old;
+    struct index_file *table;
+    char *tmp_path;
+    FILE *out;
+    bool ok = true;
+
+    map_index(&old, index_path);
+    table = calloc(nfiles + 1, sizeof(struct index_file));
+    tmp_path = malloc(strlen(index_path) + sizeof(".tmp"));
+    if (table == NULL || tmp_path == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    sprintf(tmp_path, "%s.tmp", index_path);
+    if ((out = fopen(tmp_path, "w")) == NULL) {
+        perror(tmp_path);
+        exit(1);
+    }
+    /* The header is rewritten once the table's place is known. */
+    fwrite(&hdr, sizeof(hdr), 1, out);
+
+    for (int i = 0; i < nfiles; i++) {
+        struct index_file *e = &table[hdr.nfiles];
+        const struct index_file *prev;
+        const char *words;
+        word_count_list_t counts;
+        struct stat st;
+        FILE *infile;
+
+        if ((infile = fopen(files[i], "r")) == NULL || fstat(fileno(infile), &st) != 0) {
+            perror(files[i]);
+            if (infile != NULL) {
+                fclose(infile);
+            }
+            ok = false;
+            continue;
+        }
+        e->size = st.st_size;
+        e->mtime_sec = st.st_mtim.tv_sec;
+        e->mtime_nsec = st.st_mtim.tv_nsec;
+
+        prev = find_entry(&old, files[i], i);
+        if (prev != NULL && prev->size == e->size &&
+            prev->mtime_sec == e->mtime_sec && prev->mtime_nsec == e->mtime_nsec) {
+            words = old.map + prev->words_off;
+            if (!records_valid(words, prev->words_len)) {
+                fprintf(stderr, "%s: damaged counts in index, recounting\n", files[i]);
+                words = NULL;
+            }
+        } else {
+            words = NULL;
+        }
+
+        init_words(&counts);
+        if (words == NULL && !count_file(&counts, infile, files[i], nthreads)) {
+            /* Left out of the new index, so the next run counts it again. */
+            free_words(&counts);
+            fclose(infile);
+            ok = false;
+            continue;
+        }
+
+        e->path_off = ftello(out);
+        fwrite(files[i], 1, strlen(files[i]) + 1, out);
+        e->words_off = ftello(out);
+        if (words != NULL) {
+            /* Unchanged since the last run: copy its counts across. */
+            merge_records(wclist, words, prev->words_len);
+            fwrite(words, 1, prev->words_len, out);
+        } else {
+            /*
+             * New or changed: counted on its own, so its contribution can be
+             * stored separately from the others.
+             */
+            fwrite_records(&counts, out);
+            merge_words(wclist, &counts);
+        }
+        free_words(&counts);
+        fclose(infile);
+        e->words_len = ftello(out) - e->words_off;
+        hdr.nfiles++;
+    }
+
+    /* Pad so the table is aligned in the mapping on the next run. */
+    hdr.table_off = ftello(out);
+    while (hdr.table_off % sizeof(uint64_t) != 0) {
+        fputc('\0', out);
+        hdr.table_off++;
+    }
+    fwrite(table, sizeof(struct index_file), hdr.nfiles, out);
+    fseeko(out, 0, SEEK_SET);
+    fwrite(&hdr, sizeof(hdr), 1, out);
+
+    if (ferror(out) | (fclose(out) != 0)) {
+        perror(tmp_path);
+        unlink(tmp_path);
+    } else if (rename(tmp_path, index_path) != 0) {
+        perror(index_path);
+        unlink(tmp_path);
+    }
+
+    if (old.map != NULL) {
+        munmap(old.map, old.size);
+    }
+    free(tmp_path);
+    free(table);
+    return ok;
+}
@@ -0,0 +1,69 @@
+/*
+ * The word_index interface keeps word counts on disk between runs, so that
+ * counting an unchanged set of files again only reads back the counts
+ * stored for them. Each file's counts are stored separately, together with
+ * its size and modification time, and a file whose size or modification
+ * time has changed since is counted afresh.
+ */
+
+/*
+ * Copyright (C) 2019 University of California, Berkeley
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WORD_INDEX_H
+#define WORD_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "word_count.h"
+
+#define INDEX_MAGIC "WCINDEX2"
+
+/*
+ * An index file starts with this header. Each file's path and count records
+ * (see struct count_record) follow, and the table of files comes last.
+ */
+struct index_header {
+    char magic[8];
+    uint64_t encoding; /* enum word_encoding the counts were made with. */
+    uint64_t nfiles;
+    uint64_t table_off;
+};
+
+/* Table entry for one counted file. Offsets are from the start of the index. */
+struct index_file {
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t path_off; /* NUL-terminated. */
+    uint64_t words_off;
+    uint64_t words_len;
+};
+
+/*
+ * Counts the words in files[0..nfiles) into a word count list, reusing the
+ * counts stored in the index at index_path for files that have not changed,
+ * and replaces the index with one covering exactly these files. Files that
+ * are counted use count_words_parallel with nthreads. A missing or damaged
+ * index, or one counted with another word encoding, is treated as empty, and
+ * a file whose stored counts are damaged is counted afresh. Returns false if a
+ * file could not be read; its counts are then left out of both the list and
+ * the new index.
+ */
+bool count_words_indexed(word_count_list_t *wclist, char **files, int nfiles,
+                         const char *index_path, int nthreads);
+
+#endif /* WORD_INDEX_H */
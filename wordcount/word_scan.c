@@ -0,0 +1,117 @@
+/*
+ * SIMD implementations of the word_scan interface, and the startup code that
+ * picks between them. Setting WORD_SCAN=scalar or
+ * WORD_SCAN=sse2 in the environment caps the kernel used, which is handy
+ * for comparing them.
+ */
+
+/*
+ * Copyright (C) 2019 University of California, Berkeley
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "word_scan.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#ifdef HAVE_X86_SIMD
+/*
+ * A byte c is a letter iff (c | 0x20) - 'a' is below 26 as an unsigned byte.
+ * There is no unsigned byte compare, but t <= 25 iff min(t, 25) == t.
+ */
+__attribute__((target("sse2")))
+static inline uint64_t alpha_mask16_sse2(const char *buf) {
+    __m128i v = _mm_loadu_si128((const __m128i *) buf);
+    __m128i t = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)),
+                             _mm_set1_epi8('a'));
+    __m128i alpha = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(25)), t);
+    return (uint16_t) _mm_movemask_epi8(alpha);
+}
+
+__attribute__((target("sse2")))
+static uint64_t alpha_mask64_sse2(const char *buf) {
+    return alpha_mask16_sse2(buf) | alpha_mask16_sse2(buf + 16) << 16 |
+           alpha_mask16_sse2(buf + 32) << 32 | alpha_mask16_sse2(buf + 48) << 48;
+}
+
+/* movemask collects each byte's top bit, which is set from 0x80 up. */
+__attribute__((target("sse2")))
+static inline uint64_t utf8_mask16_sse2(const char *buf) {
+    __m128i v = _mm_loadu_si128((const __m128i *) buf);
+    return alpha_mask16_sse2(buf) | (uint16_t) _mm_movemask_epi8(v);
+}
+
+__attribute__((target("sse2")))
+static uint64_t utf8_mask64_sse2(const char *buf) {
+    return utf8_mask16_sse2(buf) | utf8_mask16_sse2(buf + 16) << 16 |
+           utf8_mask16_sse2(buf + 32) << 32 | utf8_mask16_sse2(buf + 48) << 48;
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t alpha_mask32_avx2(const char *buf) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) buf);
+    __m256i t = _mm256_sub_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)),
+                                _mm256_set1_epi8('a'));
+    __m256i alpha = _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(25)), t);
+    return (uint32_t) _mm256_movemask_epi8(alpha);
+}
+
+__attribute__((target("avx2")))
+static uint64_t alpha_mask64_avx2(const char *buf) {
+    return alpha_mask32_avx2(buf) | alpha_mask32_avx2(buf + 32) << 32;
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t utf8_mask32_avx2(const char *buf) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) buf);
+    return alpha_mask32_avx2(buf) | (uint32_t) _mm256_movemask_epi8(v);
+}
+
+__attribute__((target("avx2")))
+static uint64_t utf8_mask64_avx2(const char *buf) {
+    return utf8_mask32_avx2(buf) | utf8_mask32_avx2(buf + 32) << 32;
+}
+#endif /* HAVE_X86_SIMD */
+
+uint64_t (*alpha_mask64)(const char *) = NULL;
+uint64_t (*utf8_mask64)(const char *) = NULL;
+const char *word_scan_kernel = "scalar";
+
+/* Runs before main, so the kernel never changes while threads use it. */
+__attribute__((constructor)) static void word_scan_init(void) {
+#ifdef HAVE_X86_SIMD
+    const char *cap = getenv("WORD_SCAN");
+
+    if (cap != NULL && strcmp(cap, "scalar") == 0) {
+        return;
+    }
+    __builtin_cpu_init();
+    if ((cap == NULL || strcmp(cap, "sse2") != 0) &&
+        __builtin_cpu_supports("avx2")) {
+        alpha_mask64 = alpha_mask64_avx2;
+        utf8_mask64 = utf8_mask64_avx2;
+        word_scan_kernel = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        alpha_mask64 = alpha_mask64_sse2;
+        utf8_mask64 = utf8_mask64_sse2;
+        word_scan_kernel = "sse2";
+    }
+#endif /* HAVE_X86_SIMD */
+}
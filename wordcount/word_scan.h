@@ -0,0 +1,48 @@
+/*
+ * The word_scan interface provides the byte-classification kernel used to
+ * split a buffer into words. On x86 it classifies 16 (SSE2) or 32 (AVX2)
+ * bytes per step, chosen at startup from what the CPU supports; elsewhere
+ * callers keep using isalpha one byte at a time.
+ */
+
+/*
+ * Copyright (C) 2019 University of California, Berkeley
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WORD_SCAN_H
+#define WORD_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Returns a mask with bit k set iff buf[k] is alphabetic, for k in [0, 64).
+ * Alphabetic means isalpha in the "C" locale, i.e. ASCII letters. All 64
+ * bytes must be readable. NULL if no SIMD kernel is available, in which case
+ * callers should test one byte at a time with isalpha.
+ */
+extern uint64_t (*alpha_mask64)(const char *buf);
+
+/*
+ * As alpha_mask64, but also sets the bits of bytes 0x80 and above, which
+ * are the bytes of multi-byte UTF-8 sequences. NULL exactly when
+ * alpha_mask64 is.
+ */
+extern uint64_t (*utf8_mask64)(const char *buf);
+
+/* Name of the kernel in use: "avx2", "sse2" or "scalar". */
+extern const char *word_scan_kernel;
+
+#endif /* WORD_SCAN_H */
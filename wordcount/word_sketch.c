@@ -0,0 +1,404 @@
+/*
+ * Implementation of the word_sketch interface. The Space-Saving summary
+ * keeps its entries in a min-heap by count, so the word to evict is always
+ * at the root, and finds them by word through an open-addressing index with
+ * linear probing.
+ */
+
+/*
+ * Copyright (C) 2019 University of California, Berkeley
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "word_sketch.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "word_count.h"
+#include "word_emit.h"
+
+/* Column of the Count-Min counter for hash in row, by double hashing. */
+static inline size_t sketch_column(uint64_t hash, int row) {
+    uint32_t h1 = hash;
+    uint32_t h2 = (hash >> 32) | 1;
+    return (h1 + row * h2) & (SKETCH_WIDTH - 1);
+}
+
+/*
+ * Returns the slot of the index that holds word, or the free slot where it
+ * would go.
+ */
+static size_t index_slot(const struct word_sketch *sk, const char *word,
+                         uint64_t hash) {
+    size_t i = hash & sk->index_mask;
+    while (sk->index[i] != 0) {
+        const struct sketch_entry *e = &sk->entries[sk->index[i] - 1];
+        if (e->hash == hash && strcmp(e->word, word) == 0) {
+            break;
+        }
+        i = (i + 1) & sk->index_mask;
+    }
+    return i;
+}
+
+/*
+ * Empties slot i, moving later entries of its probe run back so that every
+ * entry stays reachable from its home slot.
+ */
+static void index_remove(struct word_sketch *sk, size_t i) {
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & sk->index_mask;
+        if (sk->index[j] == 0) {
+            break;
+        }
+        size_t home = sk->entries[sk->index[j] - 1].hash & sk->index_mask;
+        /* The entry at j can fill i unless its home lies in (i, j]. */
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) {
+            continue;
+        }
+        sk->index[i] = sk->index[j];
+        i = j;
+    }
+    sk->index[i] = 0;
+}
+
+static void heap_swap(struct word_sketch *sk, size_t a, size_t b) {
+    size_t t = sk->heap[a];
+    sk->heap[a] = sk->heap[b];
+    sk->heap[b] = t;
+    sk->entries[sk->heap[a]].heap = a;
+    sk->entries[sk->heap[b]].heap = b;
+}
+
+static inline uint64_t heap_count(const struct word_sketch *sk, size_t i) {
+    return sk->entries[sk->heap[i]].count;
+}
+
+static void sift_up(struct word_sketch *sk, size_t i) {
+    while (i > 0 && heap_count(sk, i) < heap_count(sk, (i - 1) / 2)) {
+        heap_swap(sk, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void sift_down(struct word_sketch *sk, size_t i) {
+    for (;;) {
+        size_t least = i;
+        size_t child = 2 * i + 1;
+        if (child < sk->len && heap_count(sk, child) < heap_count(sk, least)) {
+            least = child;
+        }
+        if (child + 1 < sk->len && heap_count(sk, child + 1) < heap_count(sk, least)) {
+            least = child + 1;
+        }
+        if (least == i) {
+            return;
+        }
+        heap_swap(sk, i, least);
+        i = least;
+    }
+}
+
+/* Tracks word, which the sketch takes ownership of. There must be room. */
+static void entry_append(struct word_sketch *sk, char *word, uint64_t hash,
+                         uint64_t count, uint64_t error) {
+    size_t idx = sk->len++;
+    struct sketch_entry *e = &sk->entries[idx];
+    e->word = word;
+    e->hash = hash;
+    e->count = count;
+    e->error = error;
+    e->heap = idx;
+    sk->heap[idx] = idx;
+    sk->index[index_slot(sk, word, hash)] = idx + 1;
+    sift_up(sk, idx);
+}
+
+/* The least count tracked, or 0 while there is room for more words. */
+static uint64_t min_count(const struct word_sketch *sk) {
+    return sk->len == sk->capacity ? sk->entries[sk->heap[0]].count : 0;
+}
+
+bool sketch_init(struct word_sketch *sk, size_t capacity) {
+    size_t index_size = 1;
+    if (capacity > UINT32_MAX) {
+        return false;
+    }
+    if (capacity == 0) {
+        capacity = 1;
+    }
+    while (index_size < 2 * capacity) {
+        index_size *= 2;
+    }
+    sk->cells = calloc((size_t) SKETCH_DEPTH * SKETCH_WIDTH, sizeof(uint64_t));
+    sk->entries = malloc(capacity * sizeof(struct sketch_entry));
+    sk->heap = malloc(capacity * sizeof(size_t));
+    sk->index = calloc(index_size, sizeof(uint32_t));
+    sk->index_mask = index_size - 1;
+    sk->capacity = capacity;
+    sk->total = 0;
+    sk->len = 0;
+    if (sk->cells == NULL || sk->entries == NULL || sk->heap == NULL ||
+        sk->index == NULL) {
+        sketch_free(sk);
+        return false;
+    }
+    return true;
+}
+
+void sketch_free(struct word_sketch *sk) {
+    for (size_t i = 0; i < sk->len; i++) {
+        free(sk->entries[i].word);
+    }
+    free(sk->cells);
+    free(sk->entries);
+    free(sk->heap);
+    free(sk->index);
+    sk->cells = NULL;
+    sk->entries = NULL;
+    sk->heap = NULL;
+    sk->index = NULL;
+    sk->len = 0;
+}
+
+void sketch_add(struct word_sketch *sk, const char *word, uint64_t count) {
+    uint64_t hash = word_hash(word);
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+        sk->cells[row * SKETCH_WIDTH + sketch_column(hash, row)] += count;
+    }
+    sk->total += count;
+
+    size_t slot = index_slot(sk, word, hash);
+    if (sk->index[slot] != 0) {
+        struct sketch_entry *e = &sk->entries[sk->index[slot] - 1];
+        e->count += count;
+        sift_down(sk, e->heap);
+        return;
+    }
+    char *copy = strdup(word);
+    if (copy == NULL) {
+        perror("strdup");
+        return;
+    }
+    if (sk->len < sk->capacity) {
+        entry_append(sk, copy, hash, count, 0);
+        return;
+    }
+
+    /*
+     * Full: the new word replaces the least counted one and inherits its
+     * count, which may all have been the new word's, as its error.
+     */
+    size_t idx = sk->heap[0];
+    struct sketch_entry *e = &sk->entries[idx];
+    index_remove(sk, index_slot(sk, e->word, e->hash));
+    free(e->word);
+    e->word = copy;
+    e->hash = hash;
+    e->error = e->count;
+    e->count += count;
+    sk->index[index_slot(sk, copy, hash)] = idx + 1;
+    sift_down(sk, 0);
+}
+
+uint64_t sketch_estimate(const struct word_sketch *sk, const char *word) {
+    uint64_t hash = word_hash(word);
+    uint64_t est = UINT64_MAX;
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+        uint64_t c = sk->cells[row * SKETCH_WIDTH + sketch_column(hash, row)];
+        if (c < est) {
+            est = c;
+        }
+    }
+    return est;
+}
+
+/* qsort comparator: highest count first, then alphabetical. */
+static int more_count(const void *a, const void *b) {
+    const struct sketch_entry *e1 = a, *e2 = b;
+    if (e1->count != e2->count) {
+        return e1->count > e2->count ? -1 : 1;
+    }
+    return strcmp(e1->word, e2->word);
+}
+
+void sketch_merge(struct word_sketch *dst, const struct word_sketch *src) {
+    uint64_t min_dst = min_count(dst);
+    uint64_t min_src = min_count(src);
+    struct sketch_entry *all;
+    size_t n = 0;
+
+    for (size_t i = 0; i < (size_t) SKETCH_DEPTH * SKETCH_WIDTH; i++) {
+        dst->cells[i] += src->cells[i];
+    }
+    dst->total += src->total;
+
+    /*
+     * A word missing from a full summary may still have occurred there up to
+     * that summary's least count, so that much is added to its count and
+     * error; a summary with room to spare has every word it has seen.
+     */
+    all = malloc((dst->len + src->len) * sizeof(struct sketch_entry));
+    if (all == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    for (size_t i = 0; i < dst->len; i++) {
+        struct sketch_entry e = dst->entries[i];
+        size_t slot = index_slot(src, e.word, e.hash);
+        if (src->index[slot] != 0) {
+            e.count += src->entries[src->index[slot] - 1].count;
+            e.error += src->entries[src->index[slot] - 1].error;
+        } else {
+            e.count += min_src;
+            e.error += min_src;
+        }
+        all[n++] = e;
+    }
+    for (size_t i = 0; i < src->len; i++) {
+        struct sketch_entry e = src->entries[i];
+        if (dst->index[index_slot(dst, e.word, e.hash)] != 0) {
+            continue;
+        }
+        if ((e.word = strdup(e.word)) == NULL) {
+            perror("strdup");
+            continue;
+        }
+        e.count += min_dst;
+        e.error += min_dst;
+        all[n++] = e;
+    }
+
+    /* Keep the words with the highest counts. */
+    qsort(all, n, sizeof(struct sketch_entry), more_count);
+    memset(dst->index, 0, (dst->index_mask + 1) * sizeof(uint32_t));
+    dst->len = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i < dst->capacity) {
+            entry_append(dst, all[i].word, all[i].hash, all[i].count, all[i].error);
+        } else {
+            free(all[i].word);
+        }
+    }
+    free(all);
+}
+
+void sketch_fwrite(const struct word_sketch *sk, FILE *outfile) {
+    struct sketch_header hdr = { SKETCH_MAGIC, SKETCH_WIDTH, SKETCH_DEPTH,
+                                 sk->capacity, sk->total, sk->len };
+    fwrite(&hdr, sizeof(hdr), 1, outfile);
+    fwrite(sk->cells, sizeof(uint64_t), (size_t) SKETCH_DEPTH * SKETCH_WIDTH, outfile);
+    for (size_t i = 0; i < sk->len; i++) {
+        const struct sketch_entry *e = &sk->entries[i];
+        struct sketch_record rec = { e->count, e->error, strlen(e->word) };
+        fwrite(&rec, sizeof(rec), 1, outfile);
+        fwrite(e->word, 1, rec.len + 1, outfile);
+    }
+}
+
+bool sketch_merge_buffer(struct word_sketch *sk, const char *buf, size_t len) {
+    const size_t cells_size = (size_t) SKETCH_DEPTH * SKETCH_WIDTH * sizeof(uint64_t);
+    struct sketch_header hdr;
+    struct sketch_record rec;
+    struct word_sketch src;
+
+    if (len < sizeof(hdr) + cells_size) {
+        return false;
+    }
+    memcpy(&hdr, buf, sizeof(hdr));
+    if (memcmp(hdr.magic, SKETCH_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.width != SKETCH_WIDTH || hdr.depth != SKETCH_DEPTH ||
+        hdr.nentries > hdr.capacity || hdr.nentries > len) {
+        return false;
+    }
+    if (!sketch_init(&src, hdr.capacity)) {
+        return false;
+    }
+    memcpy(src.cells, buf + sizeof(hdr), cells_size);
+    src.total = hdr.total;
+
+    const char *p = buf + sizeof(hdr) + cells_size;
+    const char *end = buf + len;
+    for (uint64_t i = 0; i < hdr.nentries; i++) {
+        if ((size_t) (end - p) < sizeof(rec)) {
+            break;
+        }
+        memcpy(&rec, p, sizeof(rec));
+        const char *word = p + sizeof(rec);
+        if ((size_t) (end - word) <= rec.len || word[rec.len] != '\0' ||
+            memchr(word, '\0', rec.len) != NULL) {
+            break;
+        }
+        char *copy = strdup(word);
+        if (copy == NULL) {
+            perror("strdup");
+            break;
+        }
+        entry_append(&src, copy, word_hash(copy), rec.count, rec.error);
+        p = word + rec.len + 1;
+    }
+    bool ok = src.len == hdr.nentries && p == end;
+    if (ok) {
+        sketch_merge(sk, &src);
+    }
+    sketch_free(&src);
+    return ok;
+}
+
+/* qsort comparator: the order of less_count, on estimates. */
+static int less_estimate(const void *a, const void *b) {
+    const struct sketch_entry *e1 = a, *e2 = b;
+    if (e1->count != e2->count) {
+        return e1->count < e2->count ? -1 : 1;
+    }
+    return strcmp(e1->word, e2->word);
+}
+
+void sketch_fprint_top(const struct word_sketch *sk, size_t k, FILE *outfile) {
+    struct sketch_entry *top = malloc((sk->len + 1) * sizeof(struct sketch_entry));
+    struct word_emitter em;
+    if (top == NULL) {
+        perror("malloc");
+        return;
+    }
+
+    /* Both counts overstate the truth, so the lesser is the better estimate. */
+    for (size_t i = 0; i < sk->len; i++) {
+        uint64_t est = sketch_estimate(sk, sk->entries[i].word);
+        top[i] = sk->entries[i];
+        if (est < top[i].count) {
+            top[i].count = est;
+        }
+    }
+    qsort(top, sk->len, sizeof(struct sketch_entry), less_estimate);
+
+    emit_init(&em, outfile);
+    for (size_t i = sk->len > k ? sk->len - k : 0; i < sk->len; i++) {
+        emit_word(&em, top[i].count > INT_MAX ? INT_MAX : (int) top[i].count,
+                  top[i].word);
+    }
+    emit_finish(&em);
+    free(top);
+
+    double miss = 1;
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+        miss /= M_E;
+    }
+    fprintf(stderr, "approximate counts: each at most %llu too high, with %.0f%% confidence\n",
+            (unsigned long long) (M_E * sk->total / SKETCH_WIDTH) + 1, 100 * (1 - miss));
+}
@@ -0,0 +1,120 @@
+/*
+ * The word_sketch interface counts words approximately in fixed memory, for
+ * inputs whose vocabulary is too large for an exact word count list. A
+ * Count-Min sketch estimates the count of any word, never below its true
+ * count, and a Space-Saving summary keeps the words that may be among the
+ * most frequent. Sketches with the same dimensions merge by adding them, so
+ * workers can each keep their own and combine them at the end.
+ */
+
+/*
+ * Copyright (C) 2019 University of California, Berkeley
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WORD_SKETCH_H
+#define WORD_SKETCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Count-Min dimensions: 4 rows of 2^18 counters, 8 MB in all. An estimate is
+ * at most e / SKETCH_WIDTH of all words counted above the true count, with
+ * probability 1 - e^-SKETCH_DEPTH, or about 98%.
+ */
+#define SKETCH_WIDTH (1 << 18)
+#define SKETCH_DEPTH 4
+
+/* Words tracked as heavy-hitter candidates when the top k are wanted. */
+#define SKETCH_TRACKED(k) ((k) * 8 > 1024 ? (size_t) (k) * 8 : 1024)
+
+#define SKETCH_MAGIC "WCSKETCH"
+
+/* A word tracked by the Space-Saving summary. */
+struct sketch_entry {
+    char *word;
+    uint64_t hash;
+    uint64_t count; /* At least the word's true count. */
+    uint64_t error; /* count overstates the true count by at most this. */
+    size_t heap;    /* Position in the heap. */
+};
+
+struct word_sketch {
+    uint64_t *cells;  /* SKETCH_DEPTH rows of SKETCH_WIDTH counters. */
+    uint64_t total;   /* Sum of every count added. */
+    struct sketch_entry *entries;
+    size_t *heap;     /* Entry indices, a min-heap by count. */
+    uint32_t *index;  /* Entry index + 1 by word hash, 0 if free. */
+    size_t index_mask;
+    size_t capacity;
+    size_t len;
+};
+
+/*
+ * Serialized form, in native byte order: this header, the cells row by
+ * row, then each entry as a struct sketch_record followed by its word and
+ * a NUL.
+ */
+struct sketch_header {
+    char magic[8];
+    uint64_t width;
+    uint64_t depth;
+    uint64_t capacity;
+    uint64_t total;
+    uint64_t nentries;
+};
+
+/*
+ * Not a struct count_record: a summary's counts can outgrow 32 bits over a
+ * large input, and each also carries its Space-Saving error bound.
+ */
+struct sketch_record {
+    uint64_t count;
+    uint64_t error;
+    uint64_t len;
+};
+
+/* Initializes an empty sketch tracking up to capacity words. */
+bool sketch_init(struct word_sketch *sk, size_t capacity);
+
+void sketch_free(struct word_sketch *sk);
+
+/* Adds count occurrences of word. */
+void sketch_add(struct word_sketch *sk, const char *word, uint64_t count);
+
+/* Returns the Count-Min estimate of word's count. */
+uint64_t sketch_estimate(const struct word_sketch *sk, const char *word);
+
+/* Adds src into dst, keeping the words most likely to be frequent in either. */
+void sketch_merge(struct word_sketch *dst, const struct word_sketch *src);
+
+/* Writes a sketch to a stream in its serialized form. */
+void sketch_fwrite(const struct word_sketch *sk, FILE *outfile);
+
+/*
+ * Merges a sketch serialized in buf[0..len) into sk. Returns false if buf is
+ * not a whole sketch with the same dimensions.
+ */
+bool sketch_merge_buffer(struct word_sketch *sk, const char *buf, size_t len);
+
+/*
+ * Prints the k tracked words with the highest estimates, in the order and
+ * format of fprint_top_words, and the bound on their error to stderr.
+ */
+void sketch_fprint_top(const struct word_sketch *sk, size_t k, FILE *outfile);
+
+#endif /* WORD_SKETCH_H */
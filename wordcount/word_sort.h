@@ -0,0 +1,147 @@
+/*
+ * The word_sort header provides the merge sort that the array-based
+ * wordcount_sort implementations use. It is instantiated once per ordering
+ * with the comparison written in place, so that for less_count and
+ * less_word, the orderings every application sorts by, the compiler can
+ * inline it; any other ordering goes through its function pointer. The
+ * list-based implementations sort through an array with merge_sort_list.
+ */
+
+/*
+ * Copyright (C) 2019 University of California, Berkeley
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WORD_SORT_H
+#define WORD_SORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "word_count.h"
+#include "word_helpers.h"
+
+/* Inline forms of less_count and less_word. */
+static inline bool sort_less_count(const word_count_t *wc1, const word_count_t *wc2) {
+    return (wc1->count < wc2->count) ||
+           ((wc1->count == wc2->count) && (strcmp(wc1->word, wc2->word) < 0));
+}
+
+static inline bool sort_less_word(const word_count_t *wc1, const word_count_t *wc2) {
+    return strcmp(wc1->word, wc2->word) < 0;
+}
+
+/*
+ * Runs of up to SORT_RUN entries are first sorted in place by insertion,
+ * which keeps the small merges inside the cache.
+ */
+#define SORT_RUN 16
+
+/*
+ * Defines name as a stable merge sort of wcs[0..n) by LESS, using tmp[0..n)
+ * as scratch space. LESS may be the less parameter itself. Given a known
+ * comparison such as sort_less_count instead, each copy compiles with it
+ * inlined, which saves an indirect call per comparison; this is why the
+ * list backends move their entries into an array to sort them by less_count
+ * or less_word, rather than calling list_sort.
+ */
+#define DEFINE_WORD_SORT(name, LESS)                                           \
+    static inline void name(word_count_t **wcs, word_count_t **tmp, size_t n, \
+                            bool less(const word_count_t *,                    \
+                                      const word_count_t *)) {                 \
+        (void) less;                                                           \
+        if (n <= SORT_RUN) {                                                   \
+            for (size_t i = 1; i < n; i++) {                                   \
+                word_count_t *wc = wcs[i];                                     \
+                size_t j = i;                                                  \
+                while (j > 0 && LESS(wc, wcs[j - 1])) {                        \
+                    wcs[j] = wcs[j - 1];                                       \
+                    j--;                                                       \
+                }                                                              \
+                wcs[j] = wc;                                                   \
+            }                                                                  \
+            return;                                                            \
+        }                                                                      \
+        size_t mid = n / 2;                                                    \
+        name(wcs, tmp, mid, less);                                             \
+        name(wcs + mid, tmp, n - mid, less);                                   \
+                                                                               \
+        size_t i = 0, j = mid, k = 0;                                          \
+        while (i < mid && j < n) {                                             \
+            tmp[k++] = LESS(wcs[j], wcs[i]) ? wcs[j++] : wcs[i++];             \
+        }                                                                      \
+        while (i < mid) {                                                      \
+            tmp[k++] = wcs[i++];                                               \
+        }                                                                      \
+        /* Anything left in the right half is already in place. */            \
+        memcpy(wcs, tmp, k * sizeof(word_count_t *));                          \
+    }
+
+DEFINE_WORD_SORT(merge_sort_any, less)
+DEFINE_WORD_SORT(merge_sort_count, sort_less_count)
+DEFINE_WORD_SORT(merge_sort_word, sort_less_word)
+
+/* Sorts wcs[0..n) by less, using the inlined sorts where less is known. */
+static inline void merge_sort(word_count_t **wcs, word_count_t **tmp, size_t n,
+                              bool less(const word_count_t *, const word_count_t *)) {
+    if (less == less_count) {
+        merge_sort_count(wcs, tmp, n, less);
+    } else if (less == less_word) {
+        merge_sort_word(wcs, tmp, n, less);
+    } else {
+        merge_sort_any(wcs, tmp, n, less);
+    }
+}
+
+#ifdef PINTOS_LIST
+/*
+ * Sorts a list by less by moving its entries into an array, sorting that
+ * with merge_sort and relinking them in order. Returns false, leaving the
+ * list untouched, if the arrays cannot be allocated.
+ */
+static inline bool merge_sort_list(struct list *lst,
+                                   bool less(const word_count_t *, const word_count_t *)) {
+    size_t len = list_size(lst);
+    word_count_t **wcs;
+    word_count_t **tmp;
+    struct list_elem *e;
+    size_t n = 0;
+
+    if (len < 2) {
+        return true;
+    }
+    wcs = malloc(len * sizeof(word_count_t *));
+    tmp = malloc(len * sizeof(word_count_t *));
+    if (wcs == NULL || tmp == NULL) {
+        free(wcs);
+        free(tmp);
+        return false;
+    }
+    for (e = list_begin(lst); e != list_end(lst); e = list_next(e)) {
+        wcs[n++] = list_entry(e, word_count_t, elem);
+    }
+    merge_sort(wcs, tmp, n, less);
+    list_init(lst);
+    for (size_t i = 0; i < n; i++) {
+        list_push_back(lst, &wcs[i]->elem);
+    }
+    free(wcs);
+    free(tmp);
+    return true;
+}
+#endif /* PINTOS_LIST */
+
+#endif /* WORD_SORT_H */
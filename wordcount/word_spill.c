@@ -0,0 +1,517 @@
+/*
+ * Implementation of the word_spill interface. Each pass writes its runs,
+ * streams of count records (see struct count_record), one after another to
+ * a tmpfile(), and merges them through a min-heap of their next records.
+ */
+
+/*
+ * Copyright (C) 2019 University of California, Berkeley
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "word_spill.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2, 33)
+#define HAVE_MALLINFO2
+#include <malloc.h>
+#endif
+#endif
+
+#include "word_count.h"
+#include "word_emit.h"
+#include "word_helpers.h"
+
+/* Input counted between checks of the heap against the budget. */
+#define SPILL_BATCH_MAX (16 << 20)
+#define SPILL_BATCH_MIN (64 << 10)
+
+/*
+ * Most runs merged at once, which bounds the buffers a merge holds; more
+ * runs than this take extra passes.
+ */
+#define MERGE_WIDTH 64
+#define RUN_BUFFER_MIN (4 << 10)
+#define RUN_BUFFER_MAX (1 << 20)
+
+/*
+ * Bytes of heap in use, or an estimate from the list where unknown. The
+ * estimate is 0 for an empty list, so it needs no baseline subtracted.
+ */
+static size_t heap_bytes(word_count_list_t *wclist) {
+#ifdef HAVE_MALLINFO2
+    (void) wclist;
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+#else
+    return len_words(wclist) * (sizeof(word_count_t) + 32);
+#endif
+}
+
+static void *grow(void *buf, size_t *cap, size_t need, size_t size) {
+    if (need > *cap) {
+        size_t new_cap = *cap ? *cap : 1024;
+        while (need > new_cap) {
+            new_cap *= 2;
+        }
+        if ((buf = realloc(buf, new_cap * size)) == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+        *cap = new_cap;
+    }
+    return buf;
+}
+
+/* A run being read back: what is left of it, and the record last read. */
+struct run {
+    int fd;
+    off_t off; /* Next byte of the file to read. */
+    off_t end;
+    char *buf;
+    size_t pos; /* Unread bytes are buf[pos..len). */
+    size_t len;
+    size_t size;
+    const char *word; /* Points into buf. */
+    uint32_t count;
+};
+
+/*
+ * Makes at least need unread bytes available in the buffer, unless the run
+ * ends first. Returns false if it does.
+ */
+static bool run_fill(struct run *r, size_t need) {
+    if (r->len - r->pos >= need) {
+        return true;
+    }
+    memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+    r->len -= r->pos;
+    r->pos = 0;
+    if (need > r->size) {
+        r->buf = grow(r->buf, &r->size, need, 1);
+    }
+    while (r->len < need && r->off < r->end) {
+        size_t want = r->size - r->len;
+        if ((off_t) want > r->end - r->off) {
+            want = r->end - r->off;
+        }
+        ssize_t got = pread(r->fd, r->buf + r->len, want, r->off);
+        if (got <= 0) {
+            perror("could not read spilled counts");
+            exit(1);
+        }
+        r->len += got;
+        r->off += got;
+    }
+    return r->len >= need;
+}
+
+/* Reads the next record of a run. Returns false at its end. */
+static bool run_next(struct run *r) {
+    struct count_record rec;
+    if (!run_fill(r, sizeof(rec))) {
+        return false;
+    }
+    memcpy(&rec, r->buf + r->pos, sizeof(rec));
+    if (!run_fill(r, sizeof(rec) + rec.len + 1) ||
+        r->buf[r->pos + sizeof(rec) + rec.len] != '\0') {
+        fprintf(stderr, "spilled run is truncated\n");
+        return false;
+    }
+    r->word = r->buf + r->pos + sizeof(rec);
+    r->count = rec.count;
+    r->pos += sizeof(rec) + rec.len + 1;
+    return true;
+}
+
+/*
+ * A set of runs, written one after another to a temporary file, and a
+ * min-heap of those being merged.
+ */
+struct runs {
+    FILE *file;
+    off_t *starts; /* Run i is [starts[i], starts[i + 1]), the last to EOF. */
+    size_t len;
+    size_t cap;
+    size_t buf_size; /* Read buffer of each run being merged. */
+    struct run merging[MERGE_WIDTH];
+    struct run *heap[MERGE_WIDTH];
+    size_t heap_len;
+    size_t nmerging;
+    bool (*less)(const struct run *, const struct run *);
+};
+
+static bool run_less_word(const struct run *a, const struct run *b) {
+    return strcmp(a->word, b->word) < 0;
+}
+
+static bool run_less_count(const struct run *a, const struct run *b) {
+    return a->count < b->count ||
+           (a->count == b->count && strcmp(a->word, b->word) < 0);
+}
+
+/*
+ * Sets up an empty set of runs. A merge reads each run through its own
+ * buffer, and these are sized so that a full merge keeps to half of budget.
+ */
+static void runs_init(struct runs *rs, size_t budget,
+                      bool less(const struct run *, const struct run *)) {
+    memset(rs, 0, sizeof(*rs));
+    rs->buf_size = budget / (2 * MERGE_WIDTH);
+    if (rs->buf_size < RUN_BUFFER_MIN) {
+        rs->buf_size = RUN_BUFFER_MIN;
+    } else if (rs->buf_size > RUN_BUFFER_MAX) {
+        rs->buf_size = RUN_BUFFER_MAX;
+    }
+    rs->less = less;
+}
+
+/* Starts a new run, returning the file to write its records to. */
+static FILE *runs_add(struct runs *rs) {
+    if (rs->file == NULL && (rs->file = tmpfile()) == NULL) {
+        perror("tmpfile");
+        exit(1);
+    }
+    rs->starts = grow(rs->starts, &rs->cap, rs->len + 1, sizeof(off_t));
+    rs->starts[rs->len++] = ftello(rs->file);
+    return rs->file;
+}
+
+static void heap_sift_down_runs(struct runs *rs, size_t i) {
+    for (;;) {
+        size_t least = i, child = 2 * i + 1;
+        if (child < rs->heap_len && rs->less(rs->heap[child], rs->heap[least])) {
+            least = child;
+        }
+        if (child + 1 < rs->heap_len && rs->less(rs->heap[child + 1], rs->heap[least])) {
+            least = child + 1;
+        }
+        if (least == i) {
+            return;
+        }
+        struct run *t = rs->heap[i];
+        rs->heap[i] = rs->heap[least];
+        rs->heap[least] = t;
+        i = least;
+    }
+}
+
+/* Starts merging runs [first, first + n), n at most MERGE_WIDTH. */
+static void runs_open(struct runs *rs, size_t first, size_t n) {
+    off_t eof;
+    if (fflush(rs->file) != 0 || ferror(rs->file) || (eof = ftello(rs->file)) < 0) {
+        perror("could not spill counts");
+        exit(1);
+    }
+    rs->heap_len = 0;
+    rs->nmerging = n;
+    for (size_t i = 0; i < n; i++) {
+        struct run *r = &rs->merging[i];
+        r->fd = fileno(rs->file);
+        r->off = rs->starts[first + i];
+        r->end = first + i + 1 < rs->len ? rs->starts[first + i + 1] : eof;
+        r->pos = r->len = 0;
+        r->size = rs->buf_size;
+        if ((r->buf = malloc(r->size)) == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        if (run_next(r)) {
+            rs->heap[rs->heap_len++] = r;
+        }
+    }
+    for (size_t i = rs->heap_len; i-- > 0;) {
+        heap_sift_down_runs(rs, i);
+    }
+}
+
+/* Returns the run holding the least record, or NULL once all are read. */
+static struct run *runs_peek(struct runs *rs) {
+    return rs->heap_len > 0 ? rs->heap[0] : NULL;
+}
+
+/* Moves past the least record. */
+static void runs_pop(struct runs *rs) {
+    if (!run_next(rs->heap[0])) {
+        rs->heap[0] = rs->heap[--rs->heap_len];
+    }
+    heap_sift_down_runs(rs, 0);
+}
+
+/* Ends a merge begun by runs_open. */
+static void runs_close(struct runs *rs) {
+    for (size_t i = 0; i < rs->nmerging; i++) {
+        free(rs->merging[i].buf);
+    }
+    rs->nmerging = 0;
+    rs->heap_len = 0;
+}
+
+/* Deletes every run. */
+static void runs_clear(struct runs *rs) {
+    runs_close(rs);
+    if (rs->file != NULL) {
+        fclose(rs->file);
+    }
+    free(rs->starts);
+    rs->file = NULL;
+    rs->starts = NULL;
+    rs->len = rs->cap = 0;
+}
+
+/*
+ * Writes the records being merged to out as one run, adding up the counts
+ * of a word that comes up more than once in a row.
+ */
+static void runs_write(struct runs *rs, FILE *out) {
+    char *word = NULL;
+    size_t cap = 0, len = 0;
+    uint32_t count = 0;
+    for (struct run *r; (r = runs_peek(rs)) != NULL; runs_pop(rs)) {
+        if (word != NULL && strcmp(word, r->word) == 0) {
+            count += r->count;
+            continue;
+        }
+        if (word != NULL) {
+            fwrite_record(out, count, word, len);
+        }
+        len = strlen(r->word);
+        word = grow(word, &cap, len + 1, 1);
+        memcpy(word, r->word, len + 1);
+        count = r->count;
+    }
+    if (word != NULL) {
+        fwrite_record(out, count, word, len);
+    }
+    free(word);
+}
+
+/*
+ * Starts merging every run. While there are too many to merge at once, they
+ * are first merged MERGE_WIDTH at a time into a new, shorter set of runs.
+ */
+static void runs_start(struct runs *rs) {
+    while (rs->len > MERGE_WIDTH) {
+        struct runs next;
+        runs_init(&next, 0, rs->less);
+        next.buf_size = rs->buf_size;
+        for (size_t first = 0; first < rs->len; first += MERGE_WIDTH) {
+            size_t n = rs->len - first < MERGE_WIDTH ? rs->len - first : MERGE_WIDTH;
+            FILE *out = runs_add(&next);
+            runs_open(rs, first, n);
+            runs_write(rs, out);
+            runs_close(rs);
+        }
+        runs_clear(rs);
+        *rs = next;
+    }
+    runs_open(rs, 0, rs->len);
+}
+
+/* State of the counting pass, for spill_if_full. */
+struct counting {
+    size_t budget;
+    size_t base; /* heap_bytes before counting began. */
+    struct runs runs;
+};
+
+/* Sorts a list by word and writes it out as a run, leaving it empty. */
+static void spill(struct runs *rs, word_count_list_t *wclist) {
+    wordcount_sort(wclist, less_word);
+    fwrite_records(wclist, runs_add(rs));
+    free_words(wclist);
+    init_words(wclist);
+}
+
+/*
+ * count_words_batched callback: spill the list if the heap has grown past
+ * the budget since counting began. An empty list is never spilled, even if
+ * the heap has grown for other reasons.
+ */
+static void spill_if_full(word_count_list_t *wclist, void *aux) {
+    struct counting *cs = aux;
+    size_t used = heap_bytes(wclist);
+    if (used > cs->base && used - cs->base > cs->budget && len_words(wclist) > 0) {
+        spill(&cs->runs, wclist);
+    }
+}
+
+/* An entry of the sorting pass. Its word is at off in the word buffer. */
+struct sort_entry {
+    uint32_t count;
+    uint32_t len;
+    size_t off;
+    const char *word; /* Set from off just before sorting. */
+};
+
+/* The sorting pass: entries in less_count order are collected here. */
+struct sorting {
+    size_t budget;
+    struct sort_entry *entries;
+    size_t len;
+    size_t cap;
+    char *words;
+    size_t words_len;
+    size_t words_cap;
+    size_t total; /* Entries seen so far. */
+    struct runs runs;
+};
+
+static int compare_entries(const void *a, const void *b) {
+    const struct sort_entry *e1 = a, *e2 = b;
+    if (e1->count != e2->count) {
+        return e1->count < e2->count ? -1 : 1;
+    }
+    return strcmp(e1->word, e2->word);
+}
+
+/* Sorts the collected entries into less_count order. */
+static void sort_entries(struct sorting *ss) {
+    for (size_t i = 0; i < ss->len; i++) {
+        ss->entries[i].word = ss->words + ss->entries[i].off;
+    }
+    qsort(ss->entries, ss->len, sizeof(struct sort_entry), compare_entries);
+}
+
+/* Writes the collected entries out as a sorted run and forgets them. */
+static void sorting_spill(struct sorting *ss) {
+    FILE *file = runs_add(&ss->runs);
+    sort_entries(ss);
+    for (size_t i = 0; i < ss->len; i++) {
+        fwrite_record(file, ss->entries[i].count, ss->entries[i].word,
+                      ss->entries[i].len);
+    }
+    ss->len = 0;
+    ss->words_len = 0;
+}
+
+/* Adds a word and its total count to the sorting pass. */
+static void sorting_add(struct sorting *ss, uint32_t count, const char *word) {
+    size_t len = strlen(word);
+    if (ss->len > 0 && ss->len * sizeof(struct sort_entry) + ss->words_len +
+                       len + 1 > ss->budget) {
+        sorting_spill(ss);
+    }
+    ss->entries = grow(ss->entries, &ss->cap, ss->len + 1, sizeof(struct sort_entry));
+    ss->words = grow(ss->words, &ss->words_cap, ss->words_len + len + 1, 1);
+    struct sort_entry *e = &ss->entries[ss->len++];
+    e->count = count;
+    e->len = len;
+    e->off = ss->words_len;
+    memcpy(ss->words + ss->words_len, word, len + 1);
+    ss->words_len += len + 1;
+    ss->total++;
+}
+
+/*
+ * Prints the sorting pass's entries in less_count order, skipping all but
+ * the last top if top > 0.
+ */
+static void sorting_print(struct sorting *ss, long top, FILE *outfile) {
+    size_t skip = top > 0 && ss->total > (size_t) top ? ss->total - top : 0;
+    struct word_emitter em;
+
+    emit_init(&em, outfile);
+    if (ss->runs.len == 0) {
+        sort_entries(ss);
+        for (size_t i = skip; i < ss->len; i++) {
+            emit_word(&em, ss->entries[i].count, ss->entries[i].word);
+        }
+    } else {
+        struct run *r;
+        if (ss->len > 0) {
+            sorting_spill(ss);
+        }
+        runs_start(&ss->runs);
+        for (size_t i = 0; (r = runs_peek(&ss->runs)) != NULL; i++) {
+            if (i >= skip) {
+                emit_word(&em, r->count, r->word);
+            }
+            runs_pop(&ss->runs);
+        }
+        runs_clear(&ss->runs);
+    }
+    emit_finish(&em);
+}
+
+bool count_words_spilling(char **files, int nfiles, size_t budget, long top,
+                          FILE *outfile) {
+    struct counting cs = { .budget = budget };
+    /* The sorting pass fills while the counting pass's merge holds the rest. */
+    struct sorting ss = { .budget = budget / 2 };
+    size_t batch = budget / 8;
+    word_count_list_t wclist;
+    bool ok = true;
+
+    runs_init(&cs.runs, budget, run_less_word);
+    runs_init(&ss.runs, budget, run_less_count);
+
+    if (batch > SPILL_BATCH_MAX) {
+        batch = SPILL_BATCH_MAX;
+    } else if (batch < SPILL_BATCH_MIN) {
+        batch = SPILL_BATCH_MIN;
+    }
+
+    init_words(&wclist);
+    cs.base = heap_bytes(&wclist);
+    if (nfiles == 0) {
+        count_words_batched(&wclist, stdin, batch, spill_if_full, &cs);
+    }
+    for (int i = 0; i < nfiles; i++) {
+        FILE *infile = fopen(files[i], "r");
+        if (infile == NULL) {
+            perror(files[i]);
+            ok = false;
+            continue;
+        }
+        count_words_batched(&wclist, infile, batch, spill_if_full, &cs);
+        fclose(infile);
+    }
+
+    if (cs.runs.len == 0) {
+        /* It all fit: sort and print as usual. */
+        if (top > 0) {
+            fprint_top_words(&wclist, top, less_count, outfile);
+        } else {
+            wordcount_sort(&wclist, less_count);
+            fprint_words(&wclist, outfile);
+        }
+        free_words(&wclist);
+        return ok;
+    }
+
+    /* Merge the runs, summing each word's counts, into the sorting pass. */
+    spill(&cs.runs, &wclist);
+    free_words(&wclist);
+    runs_start(&cs.runs);
+    for (struct run *r; (r = runs_peek(&cs.runs)) != NULL; runs_pop(&cs.runs)) {
+        /* Words come in order, so a repeat is always of the last one added. */
+        struct sort_entry *last = ss.len > 0 ? &ss.entries[ss.len - 1] : NULL;
+        if (last != NULL && strcmp(ss.words + last->off, r->word) == 0) {
+            last->count += r->count;
+        } else {
+            sorting_add(&ss, r->count, r->word);
+        }
+    }
+    runs_clear(&cs.runs);
+
+    sorting_print(&ss, top, outfile);
+    free(ss.entries);
+    free(ss.words);
+    return ok;
+}
@@ -0,0 +1,43 @@
+/*
+ * The word_spill interface counts words within a memory budget. While the
+ * counts fit, they are kept in a word count list as usual; once the heap
+ * outgrows the budget, the list is sorted by word, written out as a run to
+ * a temporary file and emptied. The runs are merged at the end, summing the
+ * counts of each word, and the result is put in less_count order by an
+ * external merge sort, so neither pass needs the whole vocabulary in memory.
+ */
+
+/*
+ * Copyright (C) 2019 University of California, Berkeley
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WORD_SPILL_H
+#define WORD_SPILL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Counts the words in files[0..nfiles), or in stdin if nfiles is 0, keeping
+ * the heap to about budget bytes more than it held on entry, and prints what
+ * wordcount_sort with less_count followed by fprint_words would print, or
+ * with top > 0 what fprint_top_words would. Returns false if a file could not
+ * be read.
+ */
+bool count_words_spilling(char **files, int nfiles, size_t budget, long top,
+                          FILE *outfile);
+
+#endif /* WORD_SPILL_H */
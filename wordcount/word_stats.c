@@ -0,0 +1,139 @@
+/*
+ * Implementation of the word_stats interface. Per-thread records are
+ * allocated on a thread's first use and never freed, so they outlive their
+ * threads and can be summed when the process exits.
+ */
+
+/*
+ * Copyright (C) 2019 University of California, Berkeley
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "word_stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "word_scan.h"
+
+struct thread_stats {
+    uint64_t timers[STAT_TIMERS];
+    uint64_t counters[STAT_COUNTERS];
+    struct thread_stats *next;
+};
+
+bool stats_enabled = false;
+
+/* Every thread's record, newest first. */
+static struct thread_stats *all_stats = NULL;
+static pthread_mutex_t all_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct thread_stats *my_stats = NULL;
+
+static const char *timer_names[STAT_TIMERS] = {
+    "count", "insert", "lock_wait", "sort", "print",
+};
+
+static const char *counter_names[STAT_COUNTERS] = {
+    "bytes", "words", "locks", "contended",
+};
+
+static struct thread_stats *thread_stats(void) {
+    if (my_stats == NULL) {
+        if ((my_stats = calloc(1, sizeof(struct thread_stats))) == NULL) {
+            perror("calloc");
+            exit(1);
+        }
+        pthread_mutex_lock(&all_stats_lock);
+        my_stats->next = all_stats;
+        all_stats = my_stats;
+        pthread_mutex_unlock(&all_stats_lock);
+    }
+    return my_stats;
+}
+
+void stats_add_time(enum stat_timer timer, uint64_t ns) {
+    thread_stats()->timers[timer] += ns;
+}
+
+void stats_add(enum stat_counter counter, uint64_t n) {
+    thread_stats()->counters[counter] += n;
+}
+
+static void print_row(const char *label, const struct thread_stats *ts) {
+    fprintf(stderr, "%8s", label);
+    for (int i = 0; i < STAT_TIMERS; i++) {
+        fprintf(stderr, " %11.3f", ts->timers[i] / 1e6);
+    }
+    for (int i = 0; i < STAT_COUNTERS; i++) {
+        fprintf(stderr, " %11llu", (unsigned long long) ts->counters[i]);
+    }
+    fprintf(stderr, "\n");
+}
+
+/*
+ * Prints one row per thread that recorded anything, then the totals. Threads
+ * are numbered in the order they first recorded. Timers are in milliseconds.
+ * The header also names the word-boundary scanning kernel in use.
+ */
+static void stats_summary(void) {
+    struct thread_stats total = { { 0 }, { 0 }, NULL };
+    struct thread_stats *rev = NULL;
+    char label[16];
+    int n = 0;
+
+    pthread_mutex_lock(&all_stats_lock);
+    while (all_stats != NULL) {
+        struct thread_stats *ts = all_stats;
+        all_stats = ts->next;
+        ts->next = rev;
+        rev = ts;
+    }
+    fprintf(stderr, "word count stats for pid %d (times in ms, %s scan)\n",
+            (int) getpid(), word_scan_kernel);
+    fprintf(stderr, "%8s", "thread");
+    for (int i = 0; i < STAT_TIMERS; i++) {
+        fprintf(stderr, " %11s", timer_names[i]);
+    }
+    for (int i = 0; i < STAT_COUNTERS; i++) {
+        fprintf(stderr, " %11s", counter_names[i]);
+    }
+    fprintf(stderr, "\n");
+    for (struct thread_stats *ts = rev; ts != NULL; ts = ts->next) {
+        snprintf(label, sizeof(label), "%d", n++);
+        print_row(label, ts);
+        for (int i = 0; i < STAT_TIMERS; i++) {
+            total.timers[i] += ts->timers[i];
+        }
+        for (int i = 0; i < STAT_COUNTERS; i++) {
+            total.counters[i] += ts->counters[i];
+        }
+    }
+    print_row("total", &total);
+    all_stats = rev;
+    pthread_mutex_unlock(&all_stats_lock);
+}
+
+void stats_enable(void) {
+    if (!stats_enabled) {
+        stats_enabled = true;
+        atexit(stats_summary);
+    }
+}
+
+__attribute__((constructor)) static void stats_init(void) {
+    if (getenv("WC_STATS") != NULL) {
+        stats_enable();
+    }
+}
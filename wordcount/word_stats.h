@@ -0,0 +1,102 @@
+/*
+ * The word_stats interface is opt-in instrumentation for the word counting
+ * pipeline. Each thread accumulates nanosecond timers and counters in its
+ * own record, so recording takes no locks, and a summary of every thread's
+ * record is printed to stderr at exit. It is enabled by stats_enable (the
+ * drivers' -v) or by setting WC_STATS in the environment; while disabled,
+ * each instrumented point costs one test of stats_enabled.
+ */
+
+/*
+ * Copyright (C) 2019 University of California, Berkeley
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WORD_STATS_H
+#define WORD_STATS_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Timed phases. STAT_COUNT covers a whole count_words call, reading and
+ * tokenizing as well as inserting, so the time spent outside the table is
+ * STAT_COUNT less STAT_INSERT.
+ */
+enum stat_timer {
+    STAT_COUNT,     /* count_words and count_words_range */
+    STAT_INSERT,    /* add_word and friends, called while counting */
+    STAT_LOCK_WAIT, /* blocked on a contended word count list lock */
+    STAT_SORT,      /* wordcount_sort */
+    STAT_PRINT,     /* fprint_words and fprint_top_words */
+    STAT_TIMERS,
+};
+
+enum stat_counter {
+    STAT_BYTES,     /* bytes counted in place, or read by count_words_some */
+    STAT_WORDS,     /* words inserted */
+    STAT_LOCKS,     /* list locks taken */
+    STAT_CONTENDED, /* list locks found already held */
+    STAT_COUNTERS,
+};
+
+extern bool stats_enabled;
+
+/* Turns instrumentation on. Must be called before any threads start. */
+void stats_enable(void);
+
+/* Adds ns to one of the calling thread's timers. */
+void stats_add_time(enum stat_timer timer, uint64_t ns);
+
+/* Adds n to one of the calling thread's counters. */
+void stats_add(enum stat_counter counter, uint64_t n);
+
+static inline uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Starts a timer named t, if instrumentation is on. */
+#define STATS_BEGIN(t) uint64_t t = stats_enabled ? stats_now() : 0
+
+/* Adds the time since STATS_BEGIN(t) to timer. */
+#define STATS_END(timer, t)                                                    \
+    do {                                                                       \
+        if (stats_enabled)                                                     \
+            stats_add_time(timer, stats_now() - (t));                          \
+    } while (0)
+
+/*
+ * pthread_mutex_lock that counts the acquisition and, if the lock was held,
+ * the contention and the time spent waiting for it.
+ */
+static inline void stats_mutex_lock(pthread_mutex_t *lock) {
+    if (!stats_enabled) {
+        pthread_mutex_lock(lock);
+        return;
+    }
+    stats_add(STAT_LOCKS, 1);
+    if (pthread_mutex_trylock(lock) == 0) {
+        return;
+    }
+    stats_add(STAT_CONTENDED, 1);
+    uint64_t start = stats_now();
+    pthread_mutex_lock(lock);
+    stats_add_time(STAT_LOCK_WAIT, stats_now() - start);
+}
+
+#endif /* WORD_STATS_H */
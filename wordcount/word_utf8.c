@@ -0,0 +1,243 @@
+/*
+ * Implementation of the word_utf8 interface. The tables are sorted by code
+ * point and searched by bisection.
+ */
+
+/*
+ * Copyright (C) 2019 University of California, Berkeley
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "word_utf8.h"
+
+struct letter_range {
+    uint32_t lo;
+    uint32_t hi;
+};
+
+/* Non-ASCII letters and combining marks, by script. */
+static const struct letter_range letters[] = {
+    /* Latin-1, Latin Extended-A/B, IPA and modifier letters */
+    { 0x00AA, 0x00AA }, { 0x00B5, 0x00B5 }, { 0x00BA, 0x00BA },
+    { 0x00C0, 0x00D6 }, { 0x00D8, 0x00F6 }, { 0x00F8, 0x02C1 },
+    { 0x02C6, 0x02D1 }, { 0x02E0, 0x02E4 }, { 0x02EC, 0x02EC },
+    { 0x02EE, 0x02EE },
+    /* Combining diacritical marks */
+    { 0x0300, 0x036F },
+    /* Greek and Coptic, Cyrillic */
+    { 0x0370, 0x0374 }, { 0x0376, 0x0377 }, { 0x037A, 0x037D },
+    { 0x037F, 0x037F }, { 0x0386, 0x0386 }, { 0x0388, 0x038A },
+    { 0x038C, 0x038C }, { 0x038E, 0x03A1 }, { 0x03A3, 0x03F5 },
+    { 0x03F7, 0x0481 }, { 0x0483, 0x052F },
+    /* Armenian */
+    { 0x0531, 0x0556 }, { 0x0559, 0x0559 }, { 0x0560, 0x0588 },
+    /* Hebrew */
+    { 0x0591, 0x05BD }, { 0x05BF, 0x05BF }, { 0x05C1, 0x05C2 },
+    { 0x05C4, 0x05C5 }, { 0x05C7, 0x05C7 }, { 0x05D0, 0x05EA },
+    { 0x05EF, 0x05F2 },
+    /* Arabic */
+    { 0x0610, 0x061A }, { 0x0620, 0x065F }, { 0x066E, 0x06D3 },
+    { 0x06D5, 0x06DC }, { 0x06DF, 0x06E8 }, { 0x06EA, 0x06FC },
+    { 0x06FF, 0x06FF },
+    /* Devanagari, Bengali */
+    { 0x0900, 0x0963 }, { 0x0971, 0x0983 }, { 0x0985, 0x09E3 },
+    { 0x09F0, 0x09F1 },
+    /* Thai */
+    { 0x0E01, 0x0E3A }, { 0x0E40, 0x0E4E },
+    /* Georgian, Hangul Jamo */
+    { 0x10A0, 0x10C5 }, { 0x10D0, 0x10FA }, { 0x10FC, 0x11FF },
+    /* Latin Extended Additional, Greek Extended */
+    { 0x1E00, 0x1FBC }, { 0x1FBE, 0x1FBE }, { 0x1FC2, 0x1FCC },
+    { 0x1FD0, 0x1FD3 }, { 0x1FD6, 0x1FDB }, { 0x1FE0, 0x1FEC },
+    { 0x1FF2, 0x1FFC },
+    /* Georgian supplement */
+    { 0x2D00, 0x2D25 },
+    /* Hiragana, Katakana */
+    { 0x3041, 0x3096 }, { 0x3099, 0x309A }, { 0x309D, 0x309F },
+    { 0x30A1, 0x30FA }, { 0x30FC, 0x30FF },
+    /* CJK ideographs, Hangul syllables, compatibility ideographs */
+    { 0x3400, 0x4DBF }, { 0x4E00, 0x9FFF }, { 0xAC00, 0xD7A3 },
+    { 0xF900, 0xFAFF },
+    /* Fullwidth Latin, halfwidth kana and Hangul */
+    { 0xFF21, 0xFF3A }, { 0xFF41, 0xFF5A }, { 0xFF66, 0xFFDC },
+    /* CJK ideographs beyond the BMP */
+    { 0x20000, 0x2FA1F },
+};
+
+/*
+ * The combining marks among letters, and the Hangul vowel and final
+ * consonant jamo that follow a leading consonant in decomposed syllables.
+ */
+static const struct letter_range marks[] = {
+    { 0x0300, 0x036F }, { 0x0483, 0x0489 },
+    /* Hebrew points and accents */
+    { 0x0591, 0x05BD }, { 0x05BF, 0x05BF }, { 0x05C1, 0x05C2 },
+    { 0x05C4, 0x05C5 }, { 0x05C7, 0x05C7 },
+    /* Arabic */
+    { 0x0610, 0x061A }, { 0x064B, 0x065F }, { 0x0670, 0x0670 },
+    { 0x06D6, 0x06DC }, { 0x06DF, 0x06E4 }, { 0x06E7, 0x06E8 },
+    { 0x06EA, 0x06ED },
+    /* Devanagari */
+    { 0x0900, 0x0903 }, { 0x093A, 0x093C }, { 0x093E, 0x094F },
+    { 0x0951, 0x0957 }, { 0x0962, 0x0963 },
+    /* Bengali */
+    { 0x0981, 0x0983 }, { 0x09BC, 0x09BC }, { 0x09BE, 0x09C4 },
+    { 0x09C7, 0x09C8 }, { 0x09CB, 0x09CD }, { 0x09D7, 0x09D7 },
+    { 0x09E2, 0x09E3 },
+    /* Thai */
+    { 0x0E31, 0x0E31 }, { 0x0E34, 0x0E3A }, { 0x0E47, 0x0E4E },
+    /* Hangul Jamo */
+    { 0x1160, 0x11FF },
+    /* Kana voicing marks */
+    { 0x3099, 0x309A },
+};
+
+/*
+ * Case folding: code points in [lo, hi] map to cp + delta. With step 2, only
+ * every other code point starting at lo does, as in the alternating
+ * upper/lower pairs of Latin Extended-A.
+ */
+struct fold_range {
+    uint32_t lo;
+    uint32_t hi;
+    int32_t delta;
+    uint32_t step;
+};
+
+static const struct fold_range folds[] = {
+    { 0x00C0, 0x00D6, 32, 1 },      { 0x00D8, 0x00DE, 32, 1 },
+    { 0x0100, 0x012E, 1, 2 },       { 0x0132, 0x0136, 1, 2 },
+    { 0x0139, 0x0147, 1, 2 },       { 0x014A, 0x0176, 1, 2 },
+    { 0x0178, 0x0178, -121, 1 },    { 0x0179, 0x017D, 1, 2 },
+    { 0x01CD, 0x01DB, 1, 2 },       { 0x01DE, 0x01EE, 1, 2 },
+    { 0x01F8, 0x021E, 1, 2 },       { 0x0222, 0x0232, 1, 2 },
+    { 0x0386, 0x0386, 38, 1 },      { 0x0388, 0x038A, 37, 1 },
+    { 0x038C, 0x038C, 64, 1 },      { 0x038E, 0x038F, 63, 1 },
+    { 0x0391, 0x03A1, 32, 1 },      { 0x03A3, 0x03AB, 32, 1 },
+    { 0x03D8, 0x03EE, 1, 2 },       { 0x0400, 0x040F, 80, 1 },
+    { 0x0410, 0x042F, 32, 1 },      { 0x0460, 0x0480, 1, 2 },
+    { 0x048A, 0x04BE, 1, 2 },       { 0x04C0, 0x04C0, 15, 1 },
+    { 0x04C1, 0x04CD, 1, 2 },       { 0x04D0, 0x052E, 1, 2 },
+    { 0x0531, 0x0556, 48, 1 },      { 0x10A0, 0x10C5, 7264, 1 },
+    { 0x1E00, 0x1E94, 1, 2 },       { 0x1E9E, 0x1E9E, -7615, 1 },
+    { 0x1EA0, 0x1EFE, 1, 2 },       { 0xFF21, 0xFF3A, 32, 1 },
+};
+
+size_t utf8_decode(const char *s, size_t len, uint32_t *cp) {
+    const unsigned char *u = (const unsigned char *) s;
+    uint32_t c;
+    size_t n;
+
+    if (len == 0) {
+        return 0;
+    }
+    if (u[0] < 0x80) {
+        *cp = u[0];
+        return 1;
+    } else if (u[0] >= 0xC2 && u[0] <= 0xDF) {
+        c = u[0] & 0x1F;
+        n = 2;
+    } else if (u[0] >= 0xE0 && u[0] <= 0xEF) {
+        c = u[0] & 0x0F;
+        n = 3;
+    } else if (u[0] >= 0xF0 && u[0] <= 0xF4) {
+        c = u[0] & 0x07;
+        n = 4;
+    } else {
+        return 0;
+    }
+    if (len < n) {
+        return 0;
+    }
+    for (size_t i = 1; i < n; i++) {
+        if ((u[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+        c = c << 6 | (u[i] & 0x3F);
+    }
+    /* Reject overlong forms, surrogates and anything past U+10FFFF. */
+    if ((n == 3 && c < 0x800) || (n == 4 && c < 0x10000) || c > 0x10FFFF ||
+        (c >= 0xD800 && c <= 0xDFFF)) {
+        return 0;
+    }
+    *cp = c;
+    return n;
+}
+
+size_t utf8_encode(uint32_t cp, char *out) {
+    if (cp < 0x80) {
+        out[0] = cp;
+        return 1;
+    } else if (cp < 0x800) {
+        out[0] = 0xC0 | cp >> 6;
+        out[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    } else if (cp < 0x10000) {
+        out[0] = 0xE0 | cp >> 12;
+        out[1] = 0x80 | (cp >> 6 & 0x3F);
+        out[2] = 0x80 | (cp & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | cp >> 18;
+    out[1] = 0x80 | (cp >> 12 & 0x3F);
+    out[2] = 0x80 | (cp >> 6 & 0x3F);
+    out[3] = 0x80 | (cp & 0x3F);
+    return 4;
+}
+
+/* Returns true if cp lies in one of the n sorted ranges. */
+static bool in_ranges(const struct letter_range *ranges, size_t n, uint32_t cp) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (cp < ranges[mid].lo) {
+            hi = mid;
+        } else if (cp > ranges[mid].hi) {
+            lo = mid + 1;
+        } else {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool utf8_is_letter(uint32_t cp) {
+    if (cp < 0x80) {
+        return (cp | 0x20) - 'a' < 26;
+    }
+    return in_ranges(letters, sizeof(letters) / sizeof(letters[0]), cp);
+}
+
+bool utf8_is_mark(uint32_t cp) {
+    return cp >= 0x300 && in_ranges(marks, sizeof(marks) / sizeof(marks[0]), cp);
+}
+
+uint32_t utf8_fold(uint32_t cp) {
+    size_t lo = 0, hi = sizeof(folds) / sizeof(folds[0]);
+    if (cp < 0x80) {
+        return cp - 'A' < 26 ? cp + 32 : cp;
+    }
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (cp < folds[mid].lo) {
+            hi = mid;
+        } else if (cp > folds[mid].hi) {
+            lo = mid + 1;
+        } else {
+            return (cp - folds[mid].lo) % folds[mid].step == 0
+                ? cp + folds[mid].delta : cp;
+        }
+    }
+    return cp;
+}
@@ -0,0 +1,64 @@
+/*
+ * The word_utf8 interface decodes and encodes UTF-8 and classifies code
+ * points, for splitting UTF-8 text into words. Its tables cover the letters
+ * and simple case mappings of the common scripts (Latin, Greek, Cyrillic,
+ * Armenian, Georgian, Hebrew, Arabic, the main Indic scripts, Thai, kana,
+ * Hangul and CJK ideographs), not the whole of Unicode.
+ */
+
+/*
+ * Copyright (C) 2019 University of California, Berkeley
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WORD_UTF8_H
+#define WORD_UTF8_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Decodes the UTF-8 sequence at the start of s[0..len) into *cp and returns
+ * its length in bytes, or returns 0 if it is malformed, overlong, a
+ * surrogate or cut off by len.
+ */
+size_t utf8_decode(const char *s, size_t len, uint32_t *cp);
+
+/* Writes cp to out as UTF-8 and returns the number of bytes, at most 4. */
+size_t utf8_encode(uint32_t cp, char *out);
+
+/*
+ * Returns true if cp is a letter, or a combining mark, which belongs to the
+ * word of the letter before it.
+ */
+bool utf8_is_letter(uint32_t cp);
+
+/*
+ * Returns true if cp is one of the letters that only extend the one before
+ * them: a combining mark, or a Hangul vowel or final consonant jamo. These
+ * do not count towards a word's length, so decomposed text (NFD) passes the
+ * length rule exactly when precomposed text (NFC) does. Text is not
+ * normalized, though, so an NFD word and its NFC form are still counted as
+ * two different words.
+ */
+bool utf8_is_mark(uint32_t cp);
+
+/*
+ * Returns the simple case folding of cp (its lowercase form), or cp itself.
+ * Never maps to a code point with a longer UTF-8 encoding.
+ */
+uint32_t utf8_fold(uint32_t cp);
+
+#endif /* WORD_UTF8_H */
@@ -1,5 +1,7 @@
 /*
- * Word count application with a single thread.
+ * Word count application with a single thread, or with -j N, a file at a time
+ * split across N threads. With -s or -m, counts read from stdin are printed
+ * periodically while it is still being read.
  *
  * You may NOT modify this file. Any changes you make to this file will not
  * be used when grading your submission.
@@ -23,29 +25,330 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "word_count.h"
+#include "word_emit.h"
 #include "word_helpers.h"
+#include "word_index.h"
+#include "word_spill.h"
+#include "word_stats.h"
+
+/* Most bytes of stdin taken by one read. */
+#define STREAM_STEP 65536
+
+/* Milliseconds between tries at a snapshot put off by the one printing. */
+#define STREAM_RETRY 10
+
+/*
+ * A copy of the counts at one moment, sorted and printed by its own thread
+ * so that counting carries on meanwhile. The words themselves are not
+ * copied: entries are never removed while counting, so the pointers stay
+ * valid, and only the counts change underneath.
+ */
+struct snapshot {
+    pthread_t thread;
+    bool running;
+    bool done;
+    word_count_t *wcs;
+    size_t len;
+    size_t cap;
+    long top;
+};
+
+/* foreach_word callback: append a copy of wc to the snapshot. */
+static void snapshot_add(word_count_t *wc, void *aux) {
+    struct snapshot *snap = aux;
+    if (snap->len < snap->cap) {
+        snap->wcs[snap->len++] = *wc;
+    }
+}
+
+static int snapshot_compare(const void *a, const void *b) {
+    if (less_count(a, b)) {
+        return -1;
+    }
+    return less_count(b, a);
+}
+
+/* Thread function to sort and print a snapshot. */
+static void *snapshot_print(void *arg) {
+    struct snapshot *snap = arg;
+    struct word_emitter em;
+    size_t first = 0;
+    qsort(snap->wcs, snap->len, sizeof(word_count_t), snapshot_compare);
+    if (snap->top > 0 && (size_t) snap->top < snap->len) {
+        first = snap->len - snap->top;
+    }
+    emit_init(&em, stdout);
+    for (size_t i = first; i < snap->len; i++) {
+        emit_word(&em, snap->wcs[i].count, snap->wcs[i].word);
+    }
+    emit_finish(&em);
+    printf("\n");
+    fflush(stdout);
+    __atomic_store_n(&snap->done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/*
+ * Starts printing a snapshot of wclist, unless the last one is still being
+ * printed, in which case returns false and the caller tries again later.
+ */
+static bool snapshot_start(struct snapshot *snap, word_count_list_t *wclist) {
+    if (snap->running) {
+        if (!__atomic_load_n(&snap->done, __ATOMIC_ACQUIRE)) {
+            return false;
+        }
+        pthread_join(snap->thread, NULL);
+        snap->running = false;
+    }
+    size_t len = len_words(wclist);
+    if (len > snap->cap) {
+        free(snap->wcs);
+        snap->cap = len * 2;
+        if ((snap->wcs = malloc(snap->cap * sizeof(word_count_t))) == NULL) {
+            perror("malloc");
+            snap->cap = 0;
+            return false;
+        }
+    }
+    snap->len = 0;
+    foreach_word(wclist, snapshot_add, snap);
+    snap->done = false;
+    if (pthread_create(&snap->thread, NULL, snapshot_print, snap) != 0) {
+        perror("pthread_create");
+        snapshot_print(snap);
+        return true;
+    }
+    snap->running = true;
+    return true;
+}
+
+/* Returns the monotonic clock in seconds. */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Returns how long poll may wait for stdin before the next snapshot is due,
+ * or -1 to wait for as long as it takes.
+ */
+static int stream_timeout(double interval, double next_time) {
+    if (interval <= 0) {
+        return -1;
+    }
+    double left = next_time - now();
+    if (left <= 0) {
+        return STREAM_RETRY; /* Due, but put off. */
+    }
+    return (int) (left * 1000) + 1;
+}
+
+/*
+ * Counts stdin until EOF, printing a snapshot of the counts so far every
+ * interval seconds and every step bytes (whichever are nonzero), each
+ * followed by an empty line. stdin is read as data arrives rather than a
+ * buffer at a time, and waited on with poll, so snapshots stay on time when
+ * input trickles in. A snapshot that falls due while the previous one is
+ * still printing is put off until that one is done. A word cut off by the
+ * end of a read is not in a snapshot until the rest of it arrives.
+ */
+static void count_streaming(word_count_list_t *wclist, double interval,
+                            size_t step, long top) {
+    struct snapshot snap = { .top = top };
+    struct word_carry carry = { NULL, 0, 0, false };
+    struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+    char *buf = malloc(STREAM_STEP);
+    double next_time = now() + interval;
+    size_t since = 0;
+
+    if (buf == NULL) {
+        perror("malloc");
+        count_words(wclist, stdin);
+        return;
+    }
+    for (;;) {
+        int ready = poll(&pfd, 1, stream_timeout(interval, next_time));
+        if (ready < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        if (ready > 0) {
+            ssize_t len = read(STDIN_FILENO, buf, STREAM_STEP);
+            if (len < 0 && errno == EINTR) {
+                continue;
+            }
+            if (len <= 0) {
+                if (len < 0) {
+                    perror("read");
+                }
+                break;
+            }
+            count_words_fed(wclist, &carry, buf, len);
+            since += len;
+        }
+        if ((step > 0 && since >= step) ||
+            (interval > 0 && now() >= next_time)) {
+            if (snapshot_start(&snap, wclist)) {
+                since = 0;
+                next_time = now() + interval;
+            }
+        }
+    }
+    count_words_fed(wclist, &carry, buf, 0);
+
+    if (snap.running) {
+        pthread_join(snap.thread, NULL);
+    }
+    free(snap.wcs);
+    free(carry.buf);
+    free(buf);
+}
 
 /*
  * main - handle command line and file handles.
+ *
+ * With -k N, only the N most frequent words are printed. With -s SECS or -m
+ * MB, counts read from stdin are also printed every SECS seconds or MB
+ * megabytes while reading goes on, before the final result at EOF; they are
+ * refused if files are named. With -i INDEX, counts of files unchanged since
+ * INDEX was last written are read back from it rather than counted again,
+ * and INDEX is brought up to date; it is refused without files. With -u,
+ * words are runs of UTF-8 letters, case folded; -U leaves the case of
+ * non-ASCII letters alone. With -v, time spent in each phase is reported on
+ * stderr at exit. With -M MB, counting keeps to a heap of about MB
+ * megabytes, spilling counts to temporary files once they outgrow it (see
+ * word_spill); it is single-threaded and refused with -j, -i, -s or -m.
  */
 int main(int argc, char *argv[]) {
+    int nthreads = 1;
+    long threads_arg;
+    double megabytes;
+    long top = 0;
+    double interval = 0;
+    size_t step = 0;
+    size_t budget = 0;
+    char *index_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:j:k:m:M:s:uUv")) != -1) {
+        switch (opt) {
+        case 'i':
+            index_path = optarg;
+            break;
+        case 'j':
+            if (!parse_long_arg(optarg, 1, &threads_arg) ||
+                threads_arg > INT_MAX) {
+                fprintf(stderr, "%s: -j takes a count of 1 or more\n",
+                        argv[0]);
+                return 1;
+            }
+            nthreads = threads_arg;
+            break;
+        case 'k':
+            if (!parse_long_arg(optarg, 0, &top)) {
+                fprintf(stderr, "%s: -k takes a count of 0 or more\n", argv[0]);
+                return 1;
+            }
+            break;
+        case 'm':
+            if (!parse_positive_arg(optarg, &megabytes) ||
+                megabytes * (1 << 20) < 1 || megabytes > SIZE_MAX / (1 << 20)) {
+                fprintf(stderr, "%s: -m takes a size in MB greater than 0\n",
+                        argv[0]);
+                return 1;
+            }
+            step = megabytes * (1 << 20);
+            break;
+        case 'M':
+            if (!parse_positive_arg(optarg, &megabytes) ||
+                megabytes * (1 << 20) < 1 || megabytes > SIZE_MAX / (1 << 20)) {
+                fprintf(stderr, "%s: -M takes a size in MB greater than 0\n",
+                        argv[0]);
+                return 1;
+            }
+            budget = megabytes * (1 << 20);
+            break;
+        case 's':
+            if (!parse_positive_arg(optarg, &interval)) {
+                fprintf(stderr, "%s: -s takes seconds greater than 0\n",
+                        argv[0]);
+                return 1;
+            }
+            break;
+        case 'u':
+            set_word_encoding(WORDS_UTF8_FOLD);
+            break;
+        case 'U':
+            set_word_encoding(WORDS_UTF8);
+            break;
+        case 'v':
+            stats_enable();
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-i index] [-j threads] [-k top] "
+                    "[-s secs] [-m MB] [-M MB] [-u|-U] [-v] [file ...]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    if ((interval > 0 || step > 0) && optind < argc) {
+        fprintf(stderr, "%s: -s and -m apply to stdin, not to files\n", argv[0]);
+        return 1;
+    }
+    if (index_path != NULL && optind >= argc) {
+        fprintf(stderr, "%s: -i applies to files, not to stdin\n", argv[0]);
+        return 1;
+    }
+    if (budget > 0 &&
+        (nthreads > 1 || index_path != NULL || interval > 0 || step > 0)) {
+        fprintf(stderr, "%s: -M cannot be combined with -j, -i, -s or -m\n",
+                argv[0]);
+        return 1;
+    }
+
     /* Create the empty data structure. */
     word_count_list_t word_counts;
     init_words(&word_counts);
 
-    if (argc <= 1) {
+    if (budget > 0) {
+        bool ok = count_words_spilling(argv + optind, argc - optind, budget,
+                                       top, stdout);
+        free_words(&word_counts);
+        return ok ? 0 : 1;
+    } else if (optind >= argc && (interval > 0 || step > 0)) {
+        count_streaming(&word_counts, interval, step, top);
+    } else if (optind >= argc) {
         count_words(&word_counts, stdin);
+    } else if (index_path != NULL) {
+        if (!count_words_indexed(&word_counts, argv + optind, argc - optind,
+                                 index_path, nthreads)) {
+            return 1;
+        }
     } else {
         /* Process each file. */
         int i;
-        for (i = 1; i < argc; i++) {
+        for (i = optind; i < argc; i++) {
+            if (nthreads > 1) {
+                if (!count_words_parallel(&word_counts, argv[i], nthreads)) {
+                    return 1;
+                }
+                continue;
+            }
             FILE *infile = fopen(argv[i], "r");
             if (infile == NULL) {
                 perror("fopen");
@@ -56,8 +359,17 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    /* Output final result. */
-    wordcount_sort(&word_counts, less_count);
-    fprint_words(&word_counts, stdout);
+    /* Output final result, or only the top most frequent words. */
+    if (top > 0) {
+        fprint_top_words(&word_counts, top, less_count, stdout);
+    } else {
+        STATS_BEGIN(sort);
+        wordcount_sort(&word_counts, less_count);
+        STATS_END(STAT_SORT, sort);
+        STATS_BEGIN(print);
+        fprint_words(&word_counts, stdout);
+        STATS_END(STAT_PRINT, print);
+    }
+    free_words(&word_counts);
     return 0;
 }